@@ -0,0 +1,172 @@
+//
+// fine grained work with and without running cheap tasks inline, on three
+// task mixes:
+//
+//	trivial  nothing but tasks far cheaper than a trip through the queue
+//	heavy    nothing but tasks worth sending to a worker
+//	mixed    99 trivial tasks for every heavy one, from separate call sites
+//
+// and three ways of submitting them:
+//
+//	queued    plain async(), every task goes through the pool
+//	adaptive  Options::inline_threshold, the pool times each call site and
+//	          runs the cheap ones on the calling thread
+//	tiny      async(ThreadPool::Tiny(), ...) for the trivial tasks, which the
+//	          caller knows are cheap. heavy tasks still go through the pool
+//
+//	inline_tasks [tasks] [workers] [threshold ns]
+//
+// prints the best wall time of three rounds in ms, and how many tasks a
+// round ran inline
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <rtw/thread_pool.h>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+enum class Mix
+{
+	Trivial,
+	Heavy,
+	Mixed,
+};
+
+enum class Mode
+{
+	Queued,
+	Adaptive,
+	Tiny,
+};
+
+long heavy_work(long seed)
+{
+	volatile long x = seed;
+
+	for(int i = 0; i < 20000; i++) x = x + i;
+
+	return x;
+}
+
+//
+// best of this many, all on the same pool
+//
+const int ROUNDS = 3;
+
+double submit_all(rtw::ThreadPool & pool, std::vector<rtw::Future<long>> & futures, Mix mix, Mode mode, std::size_t count)
+{
+	const auto start = Clock::now();
+
+	for(std::size_t i = 0; i < count; i++)
+	{
+		const auto heavy = mix == Mix::Heavy || (mix == Mix::Mixed && i % 100 == 99);
+		const auto seed  = long(i);
+
+		if(heavy)
+		{
+			futures.push_back(pool.async([seed]() { return heavy_work(seed); }));
+		}
+		else if(mode == Mode::Tiny)
+		{
+			futures.push_back(pool.async(rtw::ThreadPool::Tiny(), [seed]() { return seed * 3; }));
+		}
+		else
+		{
+			futures.push_back(pool.async([seed]() { return seed * 3; }));
+		}
+	}
+
+	long sum = 0;
+
+	for(auto & future : futures) sum += future.get();
+
+	const auto took = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	//
+	// so the work can't be thrown away
+	//
+	if(sum == 0) std::abort();
+
+	return took;
+}
+
+struct Run
+{
+	double      ms;
+	std::size_t ran_inline;
+};
+
+Run run(Mix mix, Mode mode, std::size_t tasks, int workers, std::chrono::nanoseconds threshold)
+{
+	rtw::ThreadPool::Options options(workers);
+
+	if(mode == Mode::Adaptive) options.inline_threshold = threshold;
+
+	rtw::ThreadPool pool(options);
+
+	//
+	// heavy tasks are a lot slower, so there are fewer of them
+	//
+	const auto count = mix == Mix::Heavy ? tasks / 100 : tasks;
+
+	std::vector<rtw::Future<long>> futures;
+
+	futures.reserve(count);
+
+	auto best = 0.0;
+
+	for(int round = 0; round < ROUNDS; round++)
+	{
+		futures.clear();
+
+		const auto took = submit_all(pool, futures, mix, mode, count);
+
+		if(round == 0 || took < best) best = took;
+	}
+
+	return Run { best, pool.stats().ran_inline / ROUNDS };
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+	const auto tasks     = argc > 1 ? std::size_t(std::strtoull(argv[1], nullptr, 10)) : std::size_t(200000);
+	const auto workers   = argc > 2 ? std::atoi(argv[2]) : 4;
+	const auto threshold = std::chrono::nanoseconds(argc > 3 ? std::atol(argv[3]) : 2000);
+
+	if(tasks == 0 || workers < 1)
+	{
+		std::fprintf(stderr, "usage: %s [tasks] [workers] [threshold ns]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::printf("%zu tasks, %d workers, %lld ns threshold\n\n", tasks, workers, static_cast<long long>(threshold.count()));
+	std::printf("%-8s %-9s %10s %12s\n", "mix", "mode", "ms", "ran inline");
+
+	const Mix  mixes[] = { Mix::Trivial, Mix::Heavy, Mix::Mixed };
+	const Mode modes[] = { Mode::Queued, Mode::Adaptive, Mode::Tiny };
+
+	const char * mix_names[]  = { "trivial", "heavy", "mixed" };
+	const char * mode_names[] = { "queued", "adaptive", "tiny" };
+
+	for(int m = 0; m < 3; m++)
+	{
+		for(int n = 0; n < 3; n++)
+		{
+			const auto result = run(mixes[m], modes[n], tasks, workers, threshold);
+
+			std::printf("%-8s %-9s %10.1f %12zu\n", mix_names[m], mode_names[n], result.ms, result.ran_inline);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+//
+// how the two schedulers scale from 1 to N workers on a fan-out workload: a
+// tree of tasks where every inner task queues [fanout] children from inside
+// the pool and waits for them (helping while it does), and every leaf burns a
+// fixed amount of cpu
+//
+//	pool_scaling [depth] [fanout] [leaf ns] [max workers]
+//
+// max workers defaults to std::thread::hardware_concurrency()
+//
+// SharedQueue sends every child through the one locked queue. WorkStealing
+// pushes them on the spawning worker's own deque, so the lock only comes into
+// it for tasks submitted from outside. prints wall time, leaves per second
+// and the speedup over one worker for each
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <rtw/thread_pool.h>
+
+namespace
+{
+
+using Clock     = std::chrono::steady_clock;
+using Scheduler = rtw::ThreadPool::Scheduler;
+
+struct Workload
+{
+	int                      depth;
+	int                      fanout;
+	std::chrono::nanoseconds leaf;
+};
+
+//
+// spins rather than sleeps, so the leaf really occupies a core
+//
+std::size_t burn(std::chrono::nanoseconds amount)
+{
+	const auto until = Clock::now() + amount;
+
+	while(Clock::now() < until) {}
+
+	return 1;
+}
+
+std::size_t node(rtw::ThreadPool & pool, const Workload & workload, int depth)
+{
+	if(depth == 0) return burn(workload.leaf);
+
+	std::vector<rtw::Future<std::size_t>> children;
+
+	children.reserve(std::size_t(workload.fanout));
+
+	for(int i = 0; i < workload.fanout; i++)
+	{
+		children.push_back(pool.async([&pool, &workload, depth]() { return node(pool, workload, depth - 1); }));
+	}
+
+	std::size_t leaves = 0;
+
+	for(auto & child : children) leaves += child.get();
+
+	return leaves;
+}
+
+//
+// best of three, in seconds
+//
+double run(Scheduler scheduler, int threads, const Workload & workload, std::size_t * leaves)
+{
+	rtw::ThreadPool::Options options(threads, scheduler);
+
+	rtw::ThreadPool pool(options);
+
+	auto best = 0.0;
+
+	for(int round = 0; round < 3; round++)
+	{
+		const auto start = Clock::now();
+
+		*leaves = pool.async([&pool, &workload]() { return node(pool, workload, workload.depth); }).get();
+
+		const auto took = std::chrono::duration<double>(Clock::now() - start).count();
+
+		if(round == 0 || took < best) best = took;
+	}
+
+	return best;
+}
+
+void sweep(const char * name, Scheduler scheduler, int max_threads, const Workload & workload)
+{
+	auto one = 0.0;
+
+	for(int threads = 1; threads <= max_threads; threads++)
+	{
+		std::size_t leaves = 0;
+
+		const auto took = run(scheduler, threads, workload, &leaves);
+
+		if(threads == 1) one = took;
+
+		std::printf("%-12s %8d %12.2f %14.0f %8.2fx\n", name, threads, took * 1e3, double(leaves) / took, one / took);
+	}
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+	Workload workload;
+
+	workload.depth  = argc > 1 ? std::atoi(argv[1]) : 4;
+	workload.fanout = argc > 2 ? std::atoi(argv[2]) : 16;
+	workload.leaf   = std::chrono::nanoseconds(argc > 3 ? std::atol(argv[3]) : 2000);
+
+	const auto max_threads = argc > 4 ? std::atoi(argv[4]) : std::max(1, int(std::thread::hardware_concurrency()));
+
+	if(workload.depth < 1 || workload.fanout < 1 || max_threads < 1)
+	{
+		std::fprintf(stderr, "usage: %s [depth] [fanout] [leaf ns] [max workers]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::printf("depth %d, fanout %d, %lld ns per leaf\n\n", workload.depth, workload.fanout, static_cast<long long>(workload.leaf.count()));
+	std::printf("%-12s %8s %12s %14s %9s\n", "scheduler", "workers", "ms", "leaves/s", "speedup");
+
+	sweep("SharedQueue",  Scheduler::SharedQueue,  max_threads, workload);
+	sweep("WorkStealing", Scheduler::WorkStealing, max_threads, workload);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,241 @@
+//
+// SpscRing and SpscQueue against SyncQueue, three ways:
+//
+//	single   one thread pushes and pops straight away, so it's the bare cost
+//	         of the queue's operations with nothing in the way
+//	1p/1c    a producer and a consumer thread going flat out, in millions
+//	         of items a second
+//	latency  the producer stamps each item and waits for the consumer to
+//	         have it before sending the next, so the queue is always empty
+//	         on a push. p50/p99 of push to pop, in ns
+//
+//	spsc_throughput [items]
+//
+// the ring's consumer spins (yielding) on try_pop, the queues block in pop.
+// the point of the SPSC pair is stages on separate cores, so run it pinned to
+// two cores of one socket (taskset -c 2,3). on a single cpu every 1p/1c
+// handoff is a context switch and the numbers mean little
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <rtw/spsc_queue.h>
+#include <rtw/sync_queue.h>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+using Item  = std::int64_t;
+
+Item now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+//
+// the same three calls for all of them
+//
+struct Ring
+{
+	static constexpr const char * name = "SpscRing";
+
+	Ring() : ring(1024) {}
+
+	void push(Item value)
+	{
+		while(!ring.try_push(std::move(value))) std::this_thread::yield();
+	}
+
+	bool try_pop(Item & value) { return ring.try_pop(value); }
+
+	Item pop()
+	{
+		Item value;
+
+		while(!ring.try_pop(value)) std::this_thread::yield();
+
+		return value;
+	}
+
+	rtw::SpscRing<Item> ring;
+};
+
+struct Spsc
+{
+	static constexpr const char * name = "SpscQueue";
+
+	Spsc() : queue(1024) {}
+
+	void push(Item value) { queue.push(std::move(value)); }
+
+	bool try_pop(Item & value)
+	{
+		auto result = queue.try_pop();
+
+		if(!result) return false;
+
+		value = result.get();
+
+		return true;
+	}
+
+	Item pop() { return queue.pop().get(); }
+
+	rtw::SpscQueue<Item> queue;
+};
+
+struct Sync
+{
+	static constexpr const char * name = "SyncQueue";
+
+	void push(Item value) { queue.push(std::move(value)); }
+
+	bool try_pop(Item & value)
+	{
+		auto result = queue.try_pop();
+
+		if(!result) return false;
+
+		value = result.get();
+
+		return true;
+	}
+
+	Item pop() { return queue.pop().get(); }
+
+	rtw::SyncQueue<Item> queue;
+};
+
+template <class Queue>
+double single(std::size_t items)
+{
+	Queue queue;
+
+	Item sum   = 0;
+	Item value = 0;
+
+	const auto start = Clock::now();
+
+	for(std::size_t i = 0; i < items; i++)
+	{
+		queue.push(Item(i));
+		queue.try_pop(value);
+
+		sum += value;
+	}
+
+	const auto took = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	if(sum != Item(items) * Item(items - 1) / 2) std::abort();
+
+	return took / double(items);
+}
+
+template <class Queue>
+double flat_out(std::size_t items)
+{
+	Queue queue;
+
+	Item sum = 0;
+
+	const auto start = Clock::now();
+
+	std::thread consumer([&]()
+	{
+		for(std::size_t i = 0; i < items; i++) sum += queue.pop();
+	});
+
+	for(std::size_t i = 0; i < items; i++) queue.push(Item(i));
+
+	consumer.join();
+
+	const auto took = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+	if(sum != Item(items) * Item(items - 1) / 2) std::abort();
+
+	return double(items) / took;
+}
+
+template <class Queue>
+std::vector<double> latency(std::size_t items)
+{
+	Queue queue;
+
+	std::atomic<std::size_t> received(0);
+	std::vector<double>      samples(items);
+
+	std::thread consumer([&]()
+	{
+		for(std::size_t i = 0; i < items; i++)
+		{
+			const auto stamp = queue.pop();
+
+			samples[i] = double(now_ns() - stamp);
+
+			received.store(i + 1, std::memory_order_release);
+		}
+	});
+
+	for(std::size_t i = 0; i < items; i++)
+	{
+		queue.push(now_ns());
+
+		while(received.load(std::memory_order_acquire) <= i) std::this_thread::yield();
+	}
+
+	consumer.join();
+
+	std::sort(samples.begin(), samples.end());
+
+	return samples;
+}
+
+double percentile(const std::vector<double> & sorted, double p)
+{
+	return sorted[std::min(sorted.size() - 1, std::size_t(p * double(sorted.size())))];
+}
+
+template <class Queue>
+void report(std::size_t items)
+{
+	const auto samples = latency<Queue>(std::max<std::size_t>(items / 100, 1000));
+
+	std::printf(
+		"%-10s %12.1f %12.2f %10.0f %10.0f\n",
+		Queue::name,
+		single<Queue>(items),
+		flat_out<Queue>(items),
+		percentile(samples, 0.5),
+		percentile(samples, 0.99));
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+	const auto items = argc > 1 ? std::size_t(std::strtoull(argv[1], nullptr, 10)) : std::size_t(5000000);
+
+	if(items < 2)
+	{
+		std::fprintf(stderr, "usage: %s [items]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::printf("%u cpus, %zu items\n\n", std::thread::hardware_concurrency(), items);
+	std::printf("%-10s %12s %12s %10s %10s\n", "queue", "single ns", "1p/1c Mops", "p50 ns", "p99 ns");
+
+	report<Ring>(items);
+	report<Spsc>(items);
+	report<Sync>(items);
+
+	return EXIT_SUCCESS;
+}
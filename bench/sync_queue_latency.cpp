@@ -0,0 +1,105 @@
+//
+// ping-pong between two threads through a pair of SyncQueues, once per Wait
+// strategy. each round trip is two handoffs, so half of it is what one
+// handoff costs. prints p50/p99 of that
+//
+//	sync_queue_latency [round trips]
+//
+// Wait::Spin only spins with more than one cpu (see detail::spin_limit), so
+// on a single cpu both rows are the futex path. pin the process to two cores
+// of one socket (taskset -c 2,3) for numbers worth comparing
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <rtw/sync_queue.h>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+using Wait  = rtw::Wait;
+
+//
+// nanoseconds per handoff, one sample per round trip
+//
+std::vector<double> ping_pong(Wait wait, std::size_t round_trips)
+{
+	rtw::SyncQueue<int> ping(wait);
+	rtw::SyncQueue<int> pong(wait);
+
+	std::thread echo([&]()
+	{
+		for(;;)
+		{
+			auto value = ping.pop();
+
+			if(!value || value.get() < 0) return;
+
+			pong.push(std::move(value.get()));
+		}
+	});
+
+	std::vector<double> samples;
+
+	samples.reserve(round_trips);
+
+	//
+	// the first few are warm up
+	//
+	for(std::size_t i = 0; i < round_trips + 1000; i++)
+	{
+		const auto start = Clock::now();
+
+		ping.push(int(i));
+		pong.pop();
+
+		const auto took = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+		if(i >= 1000) samples.push_back(took / 2);
+	}
+
+	ping.push(-1);
+	echo.join();
+
+	std::sort(samples.begin(), samples.end());
+
+	return samples;
+}
+
+double percentile(const std::vector<double> & sorted, double p)
+{
+	return sorted[std::min(sorted.size() - 1, std::size_t(p * double(sorted.size())))];
+}
+
+void report(const char * name, const std::vector<double> & sorted)
+{
+	std::printf("%-8s %10.0f %10.0f %10.0f\n", name, percentile(sorted, 0.5), percentile(sorted, 0.99), sorted.back());
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+	const auto round_trips = argc > 1 ? std::size_t(std::strtoull(argv[1], nullptr, 10)) : std::size_t(200000);
+
+	if(round_trips == 0)
+	{
+		std::fprintf(stderr, "usage: %s [round trips]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::printf("%u cpus, %zu round trips, ns per handoff\n\n", std::thread::hardware_concurrency(), round_trips);
+	std::printf("%-8s %10s %10s %10s\n", "wait", "p50", "p99", "max");
+
+	report("Sleep", ping_pong(Wait::Sleep, round_trips));
+	report("Spin",  ping_pong(Wait::Spin,  round_trips));
+
+	return EXIT_SUCCESS;
+}
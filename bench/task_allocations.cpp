@@ -0,0 +1,123 @@
+//
+// counts the heap allocations behind ThreadPool::async, per scheduler. the
+// pool and its queues are warmed up first, after that a small task (callable,
+// arguments and result well under RTW_TASK_INLINE_SIZE) should cost none:
+// the task state comes out of the TaskAllocator's cache and goes back into it
+// when the future lets go
+//
+//	task_allocations [tasks in flight] [rounds]
+//
+// each round queues [tasks in flight] tasks, then waits for them all. the
+// cache keeps up to TaskAllocator::MAX_CACHED blocks per thread, so with more
+// in flight than that the extra ones come from the heap again
+//
+// also prints what an async() plus get() costs, for what it's worth
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <rtw/thread_pool.h>
+
+namespace
+{
+
+std::atomic<std::size_t> allocations(0);
+
+} // namespace
+
+//
+// gcc can't tell these are the replacements, so it thinks free() is being
+// handed memory from operator new
+//
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void * operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	if(const auto block = std::malloc(size ? size : 1)) return block;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void * block) noexcept { std::free(block); }
+void operator delete(void * block, std::size_t) noexcept { std::free(block); }
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+void run(const char * name, rtw::ThreadPool::Scheduler scheduler, std::size_t tasks, std::size_t rounds)
+{
+	rtw::ThreadPool pool(2, scheduler);
+
+	std::vector<rtw::Future<std::size_t>> futures;
+
+	futures.reserve(tasks);
+
+	std::size_t counted = 0;
+	double      elapsed = 0;
+
+	//
+	// the first round warms everything up and isn't counted
+	//
+	for(std::size_t round = 0; round <= rounds; round++)
+	{
+		const auto before = allocations.load(std::memory_order_relaxed);
+		const auto start  = Clock::now();
+
+		for(std::size_t i = 0; i < tasks; i++)
+		{
+			futures.push_back(pool.async([](std::size_t x) { return x * 2; }, i));
+		}
+
+		std::size_t sum = 0;
+
+		for(auto & future : futures) sum += future.get();
+
+		futures.clear();
+
+		if(sum != tasks * (tasks - 1)) std::abort();
+
+		if(round == 0) continue;
+
+		elapsed += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		counted += allocations.load(std::memory_order_relaxed) - before;
+	}
+
+	const auto total = double(rounds * tasks);
+
+	std::printf("%-12s %14.3f %14.0f\n", name, double(counted) / total, elapsed / total);
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+	const auto tasks  = argc > 1 ? std::size_t(std::strtoull(argv[1], nullptr, 10)) : std::size_t(1000);
+	const auto rounds = argc > 2 ? std::size_t(std::strtoull(argv[2], nullptr, 10)) : std::size_t(200);
+
+	if(tasks == 0 || rounds == 0)
+	{
+		std::fprintf(stderr, "usage: %s [tasks in flight] [rounds]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::printf("%zu tasks in flight, %zu rounds\n\n", tasks, rounds);
+	std::printf("%-12s %14s %14s\n", "scheduler", "allocs/task", "ns/task");
+
+	run("SharedQueue",  rtw::ThreadPool::Scheduler::SharedQueue,  tasks, rounds);
+	run("WorkStealing", rtw::ThreadPool::Scheduler::WorkStealing, tasks, rounds);
+
+	return EXIT_SUCCESS;
+}
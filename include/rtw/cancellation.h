@@ -0,0 +1,272 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <utility>
+
+#include <rtw/future.h>
+#include <rtw/meta.hpp>
+#include <rtw/task_allocator.h>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// the flag a CancellationSource and its tokens share
+//
+class CancelState : public Pooled, private meta::NoCopy
+{
+
+public:
+
+	CancelState() :
+		cancelled_(false),
+		refs_(1)
+	{
+	}
+
+	void cancel() { cancelled_.store(true, std::memory_order_release); }
+	bool cancelled() const { return cancelled_.load(std::memory_order_acquire); }
+
+	void add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+	void release()
+	{
+		if(refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+	}
+
+private:
+
+	std::atomic<bool> cancelled_;
+	std::atomic<int>  refs_;
+
+};
+
+} // namespace detail
+
+//
+// handed to tasks (and to ThreadPool::async) so they can find out that nobody
+// wants their result any more. a token is cancelled once its source has been
+// cancelled or its deadline (if it has one) has passed
+//
+// checking is one load, plus a clock read if there's a deadline, so a long
+// running task can afford to check every so often and bail out
+//
+// a default constructed token never gets cancelled
+//
+class CancellationToken
+{
+
+public:
+
+	using Clock    = std::chrono::steady_clock;
+	using Deadline = Clock::time_point;
+
+	CancellationToken() :
+		state_(nullptr),
+		deadline_(Deadline::max())
+	{
+	}
+
+	CancellationToken(const CancellationToken & rhs) :
+		state_(rhs.state_),
+		deadline_(rhs.deadline_)
+	{
+		if(state_) state_->add_ref();
+	}
+
+	CancellationToken(CancellationToken && rhs) noexcept :
+		state_(rhs.state_),
+		deadline_(rhs.deadline_)
+	{
+		rhs.state_ = nullptr;
+	}
+
+	CancellationToken & operator=(CancellationToken rhs)
+	{
+		std::swap(state_, rhs.state_);
+
+		deadline_ = rhs.deadline_;
+
+		return *this;
+	}
+
+	~CancellationToken() { if(state_) state_->release(); }
+
+	//
+	// a token with no source that just expires
+	//
+	static CancellationToken expires_at(Deadline deadline)
+	{
+		return CancellationToken().with_deadline(deadline);
+	}
+
+	template <class Rep, class Period>
+	static CancellationToken expires_after(const std::chrono::duration<Rep, Period> & timeout)
+	{
+		return expires_at(Clock::now() + std::chrono::duration_cast<Clock::duration>(timeout));
+	}
+
+	//
+	// the same token, but it also expires at [deadline] (if that's sooner
+	// than any deadline it already had)
+	//
+	CancellationToken with_deadline(Deadline deadline) const
+	{
+		auto token = *this;
+
+		if(deadline < token.deadline_) token.deadline_ = deadline;
+
+		return token;
+	}
+
+	bool cancel_requested() const { return state_ && state_->cancelled(); }
+	bool expired() const { return deadline_ != Deadline::max() && Clock::now() >= deadline_; }
+
+	bool cancelled() const { return cancel_requested() || expired(); }
+
+	//
+	// false for a token that's never going to be cancelled
+	//
+	bool can_be_cancelled() const { return state_ || deadline_ != Deadline::max(); }
+
+	Deadline deadline() const { return deadline_; }
+
+private:
+
+	explicit CancellationToken(detail::CancelState * state) :
+		state_(state),
+		deadline_(Deadline::max())
+	{
+		state_->add_ref();
+	}
+
+	detail::CancelState * state_;
+	Deadline              deadline_;
+
+friend class CancellationSource;
+
+};
+
+//
+// what cancels tokens. copies of a source share the same flag
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::CancellationSource session_gone;
+//
+//	pool.async(session_gone.token(), [&] { render(page); });
+//
+//	// the client hung up, so anything of theirs that hasn't started is dropped
+//	session_gone.cancel();
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+class CancellationSource
+{
+
+public:
+
+	CancellationSource() : state_(new detail::CancelState()) {}
+
+	CancellationSource(const CancellationSource & rhs) : state_(rhs.state_) { state_->add_ref(); }
+
+	//
+	// a source that's been moved from can only be assigned to or destroyed
+	//
+	CancellationSource(CancellationSource && rhs) noexcept : state_(rhs.state_) { rhs.state_ = nullptr; }
+
+	CancellationSource & operator=(const CancellationSource & rhs)
+	{
+		rhs.state_->add_ref();
+
+		if(state_) state_->release();
+
+		state_ = rhs.state_;
+
+		return *this;
+	}
+
+	CancellationSource & operator=(CancellationSource && rhs) noexcept
+	{
+		std::swap(state_, rhs.state_);
+
+		return *this;
+	}
+
+	~CancellationSource() { if(state_) state_->release(); }
+
+	void cancel() { state_->cancel(); }
+	bool cancelled() const { return state_->cancelled(); }
+
+	CancellationToken token() const { return CancellationToken(state_); }
+
+private:
+
+	detail::CancelState * state_;
+
+};
+
+namespace detail
+{
+
+//
+// how many tasks an executor threw away without running
+//
+struct SkipCounters
+{
+	SkipCounters() :
+		cancelled(0),
+		expired(0)
+	{
+	}
+
+	std::atomic<std::size_t> cancelled;
+	std::atomic<std::size_t> expired;
+};
+
+//
+// the guard for a TaskState that checks a token before it runs. if the token
+// has been cancelled by then the call is skipped and the future ends up
+// cancelled
+//
+class CancellationGuard
+{
+
+public:
+
+	CancellationGuard(CancellationToken token, SkipCounters * counters) :
+		token_(std::move(token)),
+		counters_(counters)
+	{
+	}
+
+	bool admit() const
+	{
+		if(token_.cancel_requested()) return skip(counters_ ? &counters_->cancelled : nullptr);
+		if(token_.expired()) return skip(counters_ ? &counters_->expired : nullptr);
+
+		return true;
+	}
+
+private:
+
+	static bool skip(std::atomic<std::size_t> * counter)
+	{
+		if(counter) counter->fetch_add(1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	CancellationToken token_;
+	SkipCounters *    counters_;
+
+};
+
+template <class Function, class... Args>
+using CancellableTaskState = GuardedTaskState<CancellationGuard, Function, Args...>;
+
+} // namespace detail
+
+} // namespace rtw
@@ -0,0 +1,477 @@
+#pragma once
+
+//
+// C++20 coroutine support. everything in here disappears on compilers or
+// language modes without coroutines, so including it is always safe
+//
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <utility>
+
+#include <rtw/future.h>
+#include <rtw/meta.hpp>
+#include <rtw/task_allocator.h>
+
+#define RTW_HAS_COROUTINES 1
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// a queued task that resumes a suspended coroutine. it lives inside the
+// awaiter, which lives inside the coroutine frame, so queueing it doesn't
+// allocate
+//
+// if the executor throws it away instead of running it (because it's being
+// destroyed) the coroutine is still resumed, but the co_await throws
+// broken_promise, the same as get() on a task that never ran
+//
+class Resumer : public Task
+{
+
+public:
+
+	Resumer() : broken_(false) {}
+
+	void run() override { handle_.resume(); }
+
+	void discard() override
+	{
+		broken_ = true;
+
+		handle_.resume();
+	}
+
+protected:
+
+	~Resumer() {}
+
+	void check() const
+	{
+		if(broken_) throw std::future_error(std::future_errc::broken_promise);
+	}
+
+	std::coroutine_handle<> handle_;
+	bool                    broken_;
+
+};
+
+//
+// what ThreadPool::schedule() returns
+//
+class ScheduleAwaiter : private Resumer
+{
+
+public:
+
+	explicit ScheduleAwaiter(Executor * executor) : executor_(executor) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		handle_ = handle;
+
+		executor_->execute(TaskPtr(this));
+	}
+
+	void await_resume() const { check(); }
+
+private:
+
+	Executor * executor_;
+
+};
+
+//
+// co_await on a Future. the coroutine is resumed by the executor that
+// produced the future (or the one it suspended on, if the future doesn't have
+// one) instead of anybody blocking on it
+//
+template <class T>
+class FutureAwaiter : private Resumer
+{
+
+public:
+
+	explicit FutureAwaiter(Future<T> && future) : future_(std::move(future)) {}
+
+	bool await_ready() const { return future_.is_ready(); }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		handle_ = handle;
+
+		const auto state    = FutureAccess::state(future_);
+		const auto executor = state->executor() ? state->executor() : current_executor();
+
+		//
+		// the coroutine might be resumed (and this awaiter gone) before
+		// set_continuation returns
+		//
+		state->set_continuation(this, executor);
+	}
+
+	T await_resume()
+	{
+		check();
+
+		return future_.get();
+	}
+
+private:
+
+	Future<T> future_;
+
+};
+
+} // namespace detail
+
+template <class T>
+detail::FutureAwaiter<T> operator co_await(Future<T> && future)
+{
+	return detail::FutureAwaiter<T>(std::move(future));
+}
+
+namespace coro
+{
+
+template <class T> class Task;
+
+namespace detail
+{
+
+template <class T>
+class Promise;
+
+//
+// the parts of a Task's promise that don't care about the result type
+//
+//
+// coroutine frames come out of the same per-thread block cache as task states
+//
+class PromiseBase : public rtw::detail::Pooled
+{
+
+public:
+
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+
+		template <class Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			const auto continuation = handle.promise().continuation_;
+
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	std::suspend_always initial_suspend() const noexcept { return std::suspend_always(); }
+	FinalAwaiter final_suspend() const noexcept { return FinalAwaiter(); }
+
+	void unhandled_exception() { exception_ = std::current_exception(); }
+
+	void set_continuation(std::coroutine_handle<> continuation) { continuation_ = continuation; }
+
+protected:
+
+	void check() const
+	{
+		if(exception_) std::rethrow_exception(exception_);
+	}
+
+	std::coroutine_handle<> continuation_;
+	std::exception_ptr      exception_;
+
+};
+
+template <class T>
+class Promise : public PromiseBase
+{
+
+public:
+
+	Promise() : has_value_(false) {}
+
+	~Promise() { if(has_value_) result_.destroy(); }
+
+	Task<T> get_return_object();
+
+	template <class Value>
+	void return_value(Value && value)
+	{
+		result_.set_from([&value]() -> T { return std::forward<Value>(value); });
+
+		has_value_ = true;
+	}
+
+	T take()
+	{
+		check();
+
+		return result_.take();
+	}
+
+private:
+
+	rtw::detail::ResultStorage<T> result_;
+	bool                          has_value_;
+
+};
+
+template <>
+class Promise<void> : public PromiseBase
+{
+
+public:
+
+	Task<void> get_return_object();
+
+	void return_void() {}
+
+	void take() { check(); }
+
+};
+
+} // namespace detail
+
+//
+// a lazy coroutine. nothing runs until it's awaited (or handed to spawn()),
+// and awaiting it runs it on the awaiting thread straight away. when it
+// finishes, the awaiter is resumed on whichever thread it finished on, with no
+// trip through a queue
+//
+// to move onto a pool, co_await pool.schedule():
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::coro::Task<std::string> load(rtw::ThreadPool & pool, std::string path)
+//	{
+//		co_await pool.schedule();
+//
+//		auto text = co_await pool.async(read_file, path);
+//
+//		co_return parse(text);
+//	}
+//
+//	auto future = rtw::coro::spawn(pool, load(pool, "butt.txt"));
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+template <class T>
+class Task : private meta::NoCopy
+{
+
+public:
+
+	using promise_type = detail::Promise<T>;
+	using Handle       = std::coroutine_handle<promise_type>;
+
+	struct Awaiter
+	{
+		bool await_ready() const noexcept { return !handle || handle.done(); }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation)
+		{
+			handle.promise().set_continuation(continuation);
+
+			return handle;
+		}
+
+		//
+		// an empty Task is 'ready' so it never suspends, and throws here like
+		// a Future with no state does
+		//
+		T await_resume()
+		{
+			if(!handle) throw std::future_error(std::future_errc::no_state);
+
+			return handle.promise().take();
+		}
+
+		Handle handle;
+	};
+
+	Task() {}
+	explicit Task(Handle handle) : handle_(handle) {}
+
+	Task(Task && rhs) : handle_(std::exchange(rhs.handle_, nullptr)) {}
+
+	Task & operator=(Task && rhs)
+	{
+		if(this != &rhs)
+		{
+			reset();
+
+			handle_ = std::exchange(rhs.handle_, nullptr);
+		}
+
+		return *this;
+	}
+
+	~Task() { reset(); }
+
+	bool valid() const { return bool(handle_); }
+
+	Awaiter operator co_await() const { return Awaiter { handle_ }; }
+
+private:
+
+	void reset()
+	{
+		if(handle_) handle_.destroy();
+
+		handle_ = nullptr;
+	}
+
+	Handle handle_;
+
+};
+
+template <class T>
+Task<T> detail::Promise<T>::get_return_object()
+{
+	return Task<T>(Task<T>::Handle::from_promise(*this));
+}
+
+inline Task<void> detail::Promise<void>::get_return_object()
+{
+	return Task<void>(Task<void>::Handle::from_promise(*this));
+}
+
+namespace detail
+{
+
+//
+// a coroutine nobody awaits. it starts suspended and frees itself when it
+// finishes
+//
+struct Detached
+{
+	struct promise_type : rtw::detail::Pooled
+	{
+		Detached get_return_object() { return Detached { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+
+		std::suspend_always initial_suspend() const noexcept { return std::suspend_always(); }
+		std::suspend_never final_suspend() const noexcept { return std::suspend_never(); }
+
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+//
+// the Future side of spawn(). it's also the queued task that starts the
+// driver coroutine
+//
+template <class T>
+class SpawnState : public rtw::detail::State<T>
+{
+
+public:
+
+	static Future<T> make(rtw::detail::Executor & executor, Task<T> && task)
+	{
+		const auto block = rtw::detail::TaskAllocator::allocate(sizeof(SpawnState));
+		const auto state = new (block) SpawnState();
+
+		state->set_executor(&executor);
+
+		Future<T> future(state);
+
+		state->driver_ = drive(state, std::move(task)).handle;
+
+		executor.execute(rtw::detail::TaskPtr(state));
+
+		return future;
+	}
+
+	void run() override { driver_.resume(); }
+
+	//
+	// the driver never started, so destroying it destroys the task too
+	//
+	void discard() override
+	{
+		driver_.destroy();
+
+		this->break_promise();
+	}
+
+private:
+
+	SpawnState() {}
+
+	//
+	// the task's result (or exception) is copied into the state in one go
+	// once it's finished, and the state's producer reference goes with it
+	//
+	static Detached drive(SpawnState * state, Task<T> task)
+	{
+		const auto handle = co_await Ready { task.operator co_await() };
+
+		if(handle)
+		{
+			state->fulfil_from([handle]() -> T { return handle.promise().take(); });
+		}
+		else
+		{
+			state->fulfil_exception(std::make_exception_ptr(std::future_error(std::future_errc::no_state)));
+		}
+	}
+
+	//
+	// like awaiting the task, but hands back the finished coroutine instead
+	// of its result, so an exception doesn't escape the driver
+	//
+	struct Ready
+	{
+		bool await_ready() const noexcept { return awaiter.await_ready(); }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation)
+		{
+			return awaiter.await_suspend(continuation);
+		}
+
+		typename Task<T>::Handle await_resume() const { return awaiter.handle; }
+
+		typename Task<T>::Awaiter awaiter;
+	};
+
+	void destroy() override
+	{
+		this->~SpawnState();
+
+		rtw::detail::TaskAllocator::deallocate(this, sizeof(SpawnState));
+	}
+
+	std::coroutine_handle<> driver_;
+
+};
+
+} // namespace detail
+
+//
+// starts [task] on [executor] and gives back a Future for its result, for
+// when the thing that wants the result isn't a coroutine itself
+//
+template <class T>
+Future<T> spawn(rtw::detail::Executor & executor, Task<T> task)
+{
+	return detail::SpawnState<T>::make(executor, std::move(task));
+}
+
+} // namespace coro
+
+} // namespace rtw
+
+#endif
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rtw
+{
+
+namespace cpu
+{
+
+struct Cpu
+{
+	int id;
+
+	//
+	// the lowest numbered cpu in the same physical core, so SMT siblings
+	// share a core id
+	//
+	int core;
+	int package;
+
+	//
+	// the lowest numbered cpu sharing this one's last level cache
+	//
+	int llc;
+
+	//
+	// NUMA node. 0 on machines that don't have any
+	//
+	int node;
+};
+
+//
+// parses the kernel's cpu list format, e.g. "0-3,8,10-11". anything that
+// doesn't parse is skipped
+//
+inline std::vector<int> parse_cpu_list(const std::string & list)
+{
+	std::vector<int> cpus;
+
+	const char * p = list.c_str();
+
+	while(*p)
+	{
+		char * end;
+
+		const auto first = std::strtol(p, &end, 10);
+
+		if(end == p)
+		{
+			p++;
+
+			continue;
+		}
+
+		auto last = first;
+
+		p = end;
+
+		if(*p == '-')
+		{
+			last = std::strtol(p + 1, &end, 10);
+
+			if(end == p + 1) last = first;
+
+			p = end;
+		}
+
+		for(auto cpu = first; cpu <= last; cpu++)
+		{
+			cpus.push_back(int(cpu));
+		}
+	}
+
+	std::sort(cpus.begin(), cpus.end());
+
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+	return cpus;
+}
+
+} // namespace cpu
+
+} // namespace rtw
+
+#if defined(__linux__)
+
+#include "linux/cpu_topology.hpp"
+
+#else
+
+namespace rtw
+{
+
+namespace cpu
+{
+
+namespace detail
+{
+
+//
+// no idea what the machine looks like, so every cpu is its own core on node 0
+//
+inline std::vector<Cpu> read_cpus()
+{
+	std::vector<Cpu> cpus;
+
+	const auto count = std::max(1, int(std::thread::hardware_concurrency()));
+
+	for(int i = 0; i < count; i++)
+	{
+		cpus.push_back(Cpu { i, i, 0, 0, 0 });
+	}
+
+	return cpus;
+}
+
+} // namespace detail
+
+inline bool pin_current_thread(const std::vector<int> &)
+{
+	return false;
+}
+
+} // namespace cpu
+
+} // namespace rtw
+
+#endif
+
+namespace rtw
+{
+
+namespace cpu
+{
+
+//
+// the cpus this process is allowed to run on, and how they're grouped into
+// cores, caches and NUMA nodes
+//
+class Topology
+{
+
+public:
+
+	explicit Topology(std::vector<Cpu> cpus) :
+		cpus_(std::move(cpus))
+	{
+		std::sort(cpus_.begin(), cpus_.end(), [](const Cpu & a, const Cpu & b) { return a.id < b.id; });
+	}
+
+	//
+	// read once, the first time anybody asks
+	//
+	static const Topology & system()
+	{
+		static const Topology topology(detail::read_cpus());
+
+		return topology;
+	}
+
+	const std::vector<Cpu> & cpus() const { return cpus_; }
+
+	//
+	// nullptr if [id] isn't one of ours
+	//
+	const Cpu * find(int id) const
+	{
+		for(const auto & cpu : cpus_)
+		{
+			if(cpu.id == id) return &cpu;
+		}
+
+		return nullptr;
+	}
+
+	//
+	// one cpu per physical core (the lowest numbered sibling)
+	//
+	std::vector<int> cores() const
+	{
+		return distinct([](const Cpu & cpu) { return cpu.core; });
+	}
+
+	std::vector<int> llcs() const
+	{
+		return distinct([](const Cpu & cpu) { return cpu.llc; });
+	}
+
+	std::vector<int> nodes() const
+	{
+		return distinct([](const Cpu & cpu) { return cpu.node; });
+	}
+
+	std::vector<int> siblings_of(int id) const
+	{
+		const auto cpu = find(id);
+
+		return cpu ? select([cpu](const Cpu & c) { return c.core == cpu->core; }) : std::vector<int>();
+	}
+
+	std::vector<int> cpus_sharing_llc_with(int id) const
+	{
+		const auto cpu = find(id);
+
+		return cpu ? select([cpu](const Cpu & c) { return c.llc == cpu->llc; }) : std::vector<int>();
+	}
+
+	std::vector<int> cpus_of_node(int node) const
+	{
+		return select([node](const Cpu & c) { return c.node == node; });
+	}
+
+	//
+	// -1 if [id] isn't one of ours
+	//
+	int node_of(int id) const
+	{
+		const auto cpu = find(id);
+
+		return cpu ? cpu->node : -1;
+	}
+
+private:
+
+	template <class Key>
+	std::vector<int> distinct(Key key) const
+	{
+		std::vector<int> result;
+
+		for(const auto & cpu : cpus_) result.push_back(key(cpu));
+
+		std::sort(result.begin(), result.end());
+
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+
+		return result;
+	}
+
+	template <class Predicate>
+	std::vector<int> select(Predicate predicate) const
+	{
+		std::vector<int> result;
+
+		for(const auto & cpu : cpus_)
+		{
+			if(predicate(cpu)) result.push_back(cpu.id);
+		}
+
+		return result;
+	}
+
+	std::vector<Cpu> cpus_;
+
+};
+
+} // namespace cpu
+
+} // namespace rtw
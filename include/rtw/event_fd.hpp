@@ -0,0 +1,52 @@
+#pragma once
+
+#include <rtw/meta.hpp>
+
+namespace rtw
+{
+
+//
+// a file descriptor that's readable while it's set, for waking up something
+// sitting in poll/epoll/select. setting it twice is the same as setting it
+// once, and reading from it is clear()'s job, not the poller's
+//
+// an eventfd on Linux and a non-blocking pipe on other unixes
+//
+class EventFd : private meta::NoCopy
+{
+
+public:
+
+	EventFd();
+	~EventFd();
+
+	//
+	// the end to poll for reading
+	//
+	int fd() const { return read_fd_; }
+
+	void set();
+	void clear();
+
+private:
+
+	int read_fd_;
+
+	//
+	// the same as read_fd_ for an eventfd
+	//
+	int write_fd_;
+
+};
+
+} // namespace rtw
+
+#if defined(__linux__)
+
+#include "linux/event_fd.hpp"
+
+#else
+
+#include "unix/event_fd.hpp"
+
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// the bare minimum of a futex: sleep while a 32 bit word still holds the value
+// you last saw, and wake whoever is sleeping on it
+//
+// futex_wait can return early for no reason, so always wait in a loop that
+// re-checks the word. a waker must change the word before it calls
+// futex_wake, or a waiter can miss it
+//
+// on Linux these are the futex syscall. elsewhere they're built on the
+// ParkingLot
+//
+inline void futex_wait(std::atomic<std::uint32_t> & word, std::uint32_t expected);
+inline void futex_wait_for(std::atomic<std::uint32_t> & word, std::uint32_t expected, std::chrono::nanoseconds timeout);
+
+//
+// wakes up to [count] threads sleeping on [word]
+//
+inline void futex_wake(std::atomic<std::uint32_t> & word, int count);
+inline void futex_wake_all(std::atomic<std::uint32_t> & word);
+
+//
+// the same for a word in memory shared between processes (see ShmQueue).
+// there's no ParkingLot to fall back on across processes, so without a futex
+// futex_wait_shared just sleeps for a moment and futex_wake_shared doesn't do
+// anything
+//
+inline void futex_wait_shared(std::atomic<std::uint32_t> & word, std::uint32_t expected, std::chrono::nanoseconds timeout);
+inline void futex_wake_shared(std::atomic<std::uint32_t> & word);
+
+} // namespace detail
+
+} // namespace rtw
+
+#if defined(__linux__)
+
+#include "linux/futex.hpp"
+
+#else
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include "parking_lot.h"
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// wakers take the bucket's mutex, so they can't slip in between the check and
+// the wait
+//
+inline void futex_wait(std::atomic<std::uint32_t> & word, const std::uint32_t expected)
+{
+	auto & bucket = ParkingLot::bucket_for(&word);
+
+	std::unique_lock<std::mutex> lock(bucket.mutex);
+
+	if(word.load(std::memory_order_seq_cst) == expected) bucket.cond.wait(lock);
+}
+
+inline void futex_wait_for(std::atomic<std::uint32_t> & word, const std::uint32_t expected, const std::chrono::nanoseconds timeout)
+{
+	auto & bucket = ParkingLot::bucket_for(&word);
+
+	std::unique_lock<std::mutex> lock(bucket.mutex);
+
+	if(word.load(std::memory_order_seq_cst) == expected) bucket.cond.wait_for(lock, timeout);
+}
+
+//
+// a bucket wakes everybody in it, so [count] is only a hint
+//
+inline void futex_wake(std::atomic<std::uint32_t> & word, int)
+{
+	ParkingLot::unpark_all(&word);
+}
+
+inline void futex_wake_all(std::atomic<std::uint32_t> & word)
+{
+	ParkingLot::unpark_all(&word);
+}
+
+inline void futex_wait_shared(std::atomic<std::uint32_t> & word, const std::uint32_t expected, const std::chrono::nanoseconds timeout)
+{
+	if(word.load(std::memory_order_seq_cst) != expected) return;
+
+	std::this_thread::sleep_for(std::min(timeout, std::chrono::nanoseconds(std::chrono::microseconds(100))));
+}
+
+inline void futex_wake_shared(std::atomic<std::uint32_t> &)
+{
+}
+
+} // namespace detail
+
+} // namespace rtw
+
+#endif
@@ -0,0 +1,1181 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <rtw/parking_lot.h>
+#include <rtw/task_allocator.h>
+
+#include "future_util.h"
+
+//
+// callables (plus their bound arguments) up to this many bytes are stored
+// directly inside the task's shared state. bigger ones get their own heap
+// allocation
+//
+#ifndef RTW_TASK_INLINE_SIZE
+#define RTW_TASK_INLINE_SIZE 64
+#endif
+
+namespace rtw
+{
+
+template <class T> class Future;
+
+//
+// what get() throws for a task that was cancelled (see rtw/cancellation.h)
+// before it got to run
+//
+class TaskCancelled : public std::runtime_error
+{
+
+public:
+
+	TaskCancelled() : std::runtime_error("the task was cancelled before it started") {}
+
+};
+
+namespace detail
+{
+
+//
+// the thing that actually sits in the pool's queues
+//
+// a queued task owns one reference to itself. run() runs it and drops that
+// reference, discard() drops it without running (which breaks the promise)
+//
+class Task
+{
+
+public:
+
+	virtual void run() = 0;
+	virtual void discard() = 0;
+
+	//
+	// when the task last went into a queue. only pools that time their tasks
+	// (ThreadPool::Options::time_tasks) fill it in
+	//
+	std::chrono::steady_clock::time_point queued_at;
+
+protected:
+
+	~Task() {}
+
+};
+
+struct TaskDiscarder
+{
+	void operator()(Task * task) const { task->discard(); }
+};
+
+using TaskPtr = std::unique_ptr<Task, TaskDiscarder>;
+
+inline void run_task(TaskPtr task)
+{
+	task.release()->run();
+}
+
+//
+// somewhere to put a result that might be void or a reference
+//
+template <class T>
+class ResultStorage
+{
+
+public:
+
+	template <class Function>
+	void set_from(Function && f)
+	{
+		new (&bytes_) T(std::forward<Function>(f)());
+	}
+
+	T take() { return std::move(value()); }
+	void destroy() { value().~T(); }
+
+private:
+
+	T & value() { return *reinterpret_cast<T *>(&bytes_); }
+
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type bytes_;
+
+};
+
+template <class T>
+class ResultStorage<T &>
+{
+
+public:
+
+	template <class Function>
+	void set_from(Function && f)
+	{
+		value_ = &std::forward<Function>(f)();
+	}
+
+	T & take() { return *value_; }
+	void destroy() {}
+
+private:
+
+	T * value_;
+
+};
+
+template <>
+class ResultStorage<void>
+{
+
+public:
+
+	template <class Function>
+	void set_from(Function && f)
+	{
+		std::forward<Function>(f)();
+	}
+
+	void take() {}
+	void destroy() {}
+
+};
+
+//
+// runs tasks somewhere. ThreadPool is one
+//
+class Executor
+{
+
+public:
+
+	virtual void execute(TaskPtr task) = 0;
+
+	//
+	// runs one queued task on the calling thread, if there is one. threads
+	// that belong to the executor call this while they wait on a future so
+	// they keep doing useful work instead of blocking
+	//
+	virtual bool run_pending_task() = 0;
+
+protected:
+
+	~Executor() {}
+
+};
+
+//
+// the executor the calling thread belongs to, or nullptr
+//
+inline Executor *& current_executor()
+{
+	static thread_local Executor * executor = nullptr;
+
+	return executor;
+}
+
+//
+// the untyped half of a Future's shared state
+//
+// the status, a couple of flags and the reference count share one word so the
+// producer can publish the result, drop its reference and find out whether
+// anybody is waiting or has attached a continuation, all in one atomic op.
+// that way the consumer (usually the thread that allocated the state) is the
+// one that frees it, and the block goes back into the cache it came from
+//
+class StateBase : public Task
+{
+
+public:
+
+	enum Status
+	{
+		PENDING   = 0,
+		VALUE     = 1,
+		EXCEPTION = 2,
+		CANCELLED = 3,
+	};
+
+	//
+	// starts with two references: one for the producer and one for the
+	// consumer
+	//
+	StateBase() :
+		word_(2 * REF),
+		executor_(nullptr),
+		continuation_(nullptr),
+		continuation_executor_(nullptr)
+	{
+	}
+
+	void add_ref() { word_.fetch_add(REF, std::memory_order_relaxed); }
+
+	void release()
+	{
+		const auto old = word_.fetch_sub(REF, std::memory_order_acq_rel);
+
+		if(refs_of(old) == 1) destroy();
+	}
+
+	bool is_ready() const { return status() != PENDING; }
+	bool is_cancelled() const { return status() == CANCELLED; }
+
+	//
+	// where continuations attached with Future::then() get run
+	//
+	Executor * executor() const { return executor_; }
+	void set_executor(Executor * executor) { executor_ = executor; }
+
+	//
+	// on an executor's own thread these run the executor's other queued tasks
+	// until the state is ready (fork/join style), so a pool can't deadlock
+	// on tasks waiting for their children. anywhere else they just sleep
+	//
+	// a timed wait that's helping can overshoot its deadline by however long
+	// the task it picked up takes
+	//
+	void wait();
+
+	template <class Clock, class Duration>
+	bool wait_until(const std::chrono::time_point<Clock, Duration> & deadline);
+
+	//
+	// [task] is handed to [executor] (or just run, if there's no executor) once
+	// this state is ready. if it's already ready that happens right now. only
+	// one continuation can be attached while the state is pending
+	//
+	void set_continuation(Task * task, Executor * executor);
+
+	//
+	// takes the continuation back off a state that's still pending, dropping
+	// the reference it held. false if the state is ready, in which case the
+	// continuation has been (or is about to be) dispatched as usual
+	//
+	bool detach_continuation();
+
+protected:
+
+	static constexpr unsigned STATUS_MASK  = 0x3;
+	static constexpr unsigned WAITERS      = 0x4;
+	static constexpr unsigned CONTINUATION = 0x8;
+	static constexpr unsigned REF          = 0x10;
+
+	~StateBase() {}
+
+	virtual void destroy() = 0;
+
+	Status status() const
+	{
+		return Status(word_.load(std::memory_order_acquire) & STATUS_MASK);
+	}
+
+	//
+	// publishes the result and drops the producer's reference
+	//
+	void complete(Status status);
+
+private:
+
+	static unsigned refs_of(unsigned word) { return word / REF; }
+
+	static void dispatch(Task * task, Executor * executor)
+	{
+		if(executor) executor->execute(TaskPtr(task));
+		else task->run();
+	}
+
+	//
+	// sets WAITERS unless the state is already ready. returns true if the
+	// caller should go to sleep. must be called with the parking lot bucket
+	// locked
+	//
+	bool prepare_to_park();
+
+	template <class Clock, class Duration>
+	bool park_until(const std::chrono::time_point<Clock, Duration> & deadline);
+
+	template <class Clock, class Duration>
+	bool help_until(Executor * executor, const std::chrono::time_point<Clock, Duration> & deadline);
+
+	std::atomic<unsigned> word_;
+	Executor *            executor_;
+	Task *                continuation_;
+	Executor *            continuation_executor_;
+
+	static constexpr auto ERR_FUTURE_TWO_CONTINUATIONS =
+		"a bad programmer tried to attach a second continuation to a "
+		"future that's still pending"
+		;
+
+};
+
+inline void StateBase::wait()
+{
+	if(is_ready()) return;
+
+	if(const auto executor = current_executor())
+	{
+		help_until(executor, std::chrono::steady_clock::time_point::max());
+
+		return;
+	}
+
+	auto & bucket = ParkingLot::bucket_for(this);
+
+	std::unique_lock<std::mutex> lock(bucket.mutex);
+
+	while(prepare_to_park())
+	{
+		bucket.cond.wait(lock);
+	}
+}
+
+template <class Clock, class Duration>
+bool StateBase::wait_until(const std::chrono::time_point<Clock, Duration> & deadline)
+{
+	if(is_ready()) return true;
+
+	if(const auto executor = current_executor())
+	{
+		return help_until(executor, deadline);
+	}
+
+	return park_until(deadline);
+}
+
+template <class Clock, class Duration>
+bool StateBase::park_until(const std::chrono::time_point<Clock, Duration> & deadline)
+{
+	auto & bucket = ParkingLot::bucket_for(this);
+
+	std::unique_lock<std::mutex> lock(bucket.mutex);
+
+	while(prepare_to_park())
+	{
+		if(bucket.cond.wait_until(lock, deadline) == std::cv_status::timeout)
+		{
+			return is_ready();
+		}
+	}
+
+	return true;
+}
+
+//
+// when there's nothing to run we still have to notice new work turning up,
+// which doesn't wake us, so we only ever sleep for a short (growing) while.
+// the state finishing does wake us straight away
+//
+template <class Clock, class Duration>
+bool StateBase::help_until(Executor * const executor, const std::chrono::time_point<Clock, Duration> & deadline)
+{
+	const auto min_sleep = std::chrono::microseconds(20);
+	const auto max_sleep = std::chrono::microseconds(1000);
+
+	auto sleep = min_sleep;
+
+	while(!is_ready())
+	{
+		if(executor->run_pending_task())
+		{
+			sleep = min_sleep;
+
+			continue;
+		}
+
+		if(Clock::now() >= deadline) return false;
+
+		park_until(std::chrono::steady_clock::now() + sleep);
+
+		sleep = std::min(sleep * 2, max_sleep);
+	}
+
+	return true;
+}
+
+inline bool StateBase::prepare_to_park()
+{
+	auto word = word_.load(std::memory_order_acquire);
+
+	for(;;)
+	{
+		if((word & STATUS_MASK) != PENDING) return false;
+		if(word & WAITERS) return true;
+
+		if(word_.compare_exchange_weak(
+			word,
+			word | WAITERS,
+			std::memory_order_acq_rel,
+			std::memory_order_acquire))
+		{
+			return true;
+		}
+	}
+}
+
+//
+// complete() reads the continuation once it's seen CONTINUATION, so the
+// fields can only be written while nothing's attached (or after the state is
+// ready, when complete() is done with them)
+//
+inline void StateBase::set_continuation(Task * const task, Executor * const executor)
+{
+	const auto seen = word_.load(std::memory_order_acquire);
+
+	if((seen & STATUS_MASK) == PENDING && (seen & CONTINUATION))
+	{
+		throw std::runtime_error(ERR_FUTURE_TWO_CONTINUATIONS);
+	}
+
+	continuation_          = task;
+	continuation_executor_ = executor;
+
+	//
+	// this reference is dropped by whoever ends up dispatching the
+	// continuation
+	//
+	add_ref();
+
+	auto word = word_.load(std::memory_order_acquire);
+
+	for(;;)
+	{
+		if((word & STATUS_MASK) != PENDING)
+		{
+			dispatch(task, executor);
+			release();
+
+			return;
+		}
+
+		if(word_.compare_exchange_weak(
+			word,
+			word | CONTINUATION,
+			std::memory_order_acq_rel,
+			std::memory_order_acquire))
+		{
+			return;
+		}
+	}
+}
+
+inline bool StateBase::detach_continuation()
+{
+	auto word = word_.load(std::memory_order_acquire);
+
+	for(;;)
+	{
+		if((word & STATUS_MASK) != PENDING || !(word & CONTINUATION)) return false;
+
+		if(word_.compare_exchange_weak(
+			word,
+			word & ~CONTINUATION,
+			std::memory_order_acq_rel,
+			std::memory_order_acquire))
+		{
+			release();
+
+			return true;
+		}
+	}
+}
+
+inline void StateBase::complete(Status status)
+{
+	const auto old =
+		word_.fetch_add(unsigned(status) - REF, std::memory_order_acq_rel);
+
+	//
+	// the state may already be gone by now unless a continuation is holding on
+	// to it, but unpark_all only needs the address
+	//
+	if(old & WAITERS)
+	{
+		ParkingLot::unpark_all(this);
+	}
+
+	if(old & CONTINUATION)
+	{
+		dispatch(continuation_, continuation_executor_);
+		release();
+	}
+	else if(refs_of(old) == 1)
+	{
+		destroy();
+	}
+}
+
+//
+// the typed half
+//
+template <class T>
+class State : public StateBase
+{
+
+public:
+
+	//
+	// these set the result and drop the producer's reference
+	//
+	template <class Function>
+	void fulfil_from(Function && f)
+	{
+		try
+		{
+			result_.set_from(std::forward<Function>(f));
+		}
+		catch(...)
+		{
+			fulfil_exception(std::current_exception());
+
+			return;
+		}
+
+		complete(VALUE);
+	}
+
+	void fulfil_exception(std::exception_ptr exception)
+	{
+		exception_ = exception;
+
+		complete(EXCEPTION);
+	}
+
+	T take()
+	{
+		if(status() == EXCEPTION || status() == CANCELLED)
+		{
+			std::rethrow_exception(exception_);
+		}
+
+		return result_.take();
+	}
+
+protected:
+
+	~State()
+	{
+		if(status() == VALUE)
+		{
+			result_.destroy();
+		}
+	}
+
+	void break_promise()
+	{
+		fulfil_exception(
+			std::make_exception_ptr(
+				std::future_error(std::future_errc::broken_promise)));
+	}
+
+	//
+	// like fulfil_exception with a TaskCancelled, but the future can tell
+	//
+	void cancel()
+	{
+		exception_ = std::make_exception_ptr(TaskCancelled());
+
+		complete(CANCELLED);
+	}
+
+private:
+
+	std::exception_ptr exception_;
+	ResultStorage<T>   result_;
+
+};
+
+//
+// a function and its arguments, bound by value
+//
+template <class Function, class... Args>
+class BoundCall
+{
+
+public:
+
+	using Result = result_of_t<Function, Args...>;
+
+	template <class F, class... A>
+	BoundCall(F && f, A &&... args) :
+		call_(std::forward<F>(f), std::forward<A>(args)...)
+	{
+	}
+
+	//
+	// only ever called once so everything gets moved into the call
+	//
+	Result operator()()
+	{
+		return invoke(std::index_sequence_for<Args...>());
+	}
+
+private:
+
+	template <std::size_t... I>
+	Result invoke(std::index_sequence<I...>)
+	{
+		return std::move(std::get<0>(call_))(std::move(std::get<I + 1>(call_))...);
+	}
+
+	std::tuple<Function, Args...> call_;
+
+};
+
+//
+// stores a BoundCall in place if it's small enough, otherwise on the heap
+//
+template <class Call, bool Inline = (sizeof(Call) <= RTW_TASK_INLINE_SIZE)>
+class CallStorage
+{
+
+public:
+
+	template <class... A>
+	CallStorage(A &&... args) : call_(std::forward<A>(args)...) {}
+
+	Call & get() { return call_; }
+
+private:
+
+	Call call_;
+
+};
+
+template <class Call>
+class CallStorage<Call, false>
+{
+
+public:
+
+	template <class... A>
+	CallStorage(A &&... args) : call_(new Call(std::forward<A>(args)...)) {}
+
+	Call & get() { return *call_; }
+
+private:
+
+	std::unique_ptr<Call> call_;
+
+};
+
+//
+// what a TaskState asks just before it runs. this one always says yes
+//
+struct RunAlways
+{
+	bool admit() const { return true; }
+};
+
+//
+// a task and its future's shared state in one block
+//
+// [Guard] gets a say just before the task runs. if its admit() returns false
+// the call is skipped and the future ends up cancelled. it's an (empty, for
+// RunAlways) base so it costs nothing when there's nothing to check
+//
+template <class Guard, class Function, class... Args>
+class GuardedTaskState : public State<result_of_t<Function, Args...>>, private Guard
+{
+
+public:
+
+	using Call   = BoundCall<Function, Args...>;
+	using Result = typename Call::Result;
+
+	template <class F, class... A>
+	static GuardedTaskState * make(F && f, A &&... args)
+	{
+		return make_guarded(Guard(), std::forward<F>(f), std::forward<A>(args)...);
+	}
+
+	template <class F, class... A>
+	static GuardedTaskState * make_guarded(Guard guard, F && f, A &&... args)
+	{
+		const auto block = TaskAllocator::allocate(sizeof(GuardedTaskState));
+
+		try
+		{
+			return new (block) GuardedTaskState(std::move(guard), std::forward<F>(f), std::forward<A>(args)...);
+		}
+		catch(...)
+		{
+			TaskAllocator::deallocate(block, sizeof(GuardedTaskState));
+
+			throw;
+		}
+	}
+
+	void run() override
+	{
+		if(!Guard::admit())
+		{
+			this->cancel();
+
+			return;
+		}
+
+		this->fulfil_from(call_.get());
+	}
+
+	void discard() override
+	{
+		this->break_promise();
+	}
+
+private:
+
+	template <class F, class... A>
+	GuardedTaskState(Guard && guard, F && f, A &&... args) :
+		Guard(std::move(guard)),
+		call_(std::forward<F>(f), std::forward<A>(args)...)
+	{
+	}
+
+	void destroy() override
+	{
+		this->~GuardedTaskState();
+
+		TaskAllocator::deallocate(this, sizeof(GuardedTaskState));
+	}
+
+	CallStorage<Call> call_;
+
+};
+
+template <class Function, class... Args>
+using TaskState = GuardedTaskState<RunAlways, Function, Args...>;
+
+} // namespace detail
+
+namespace detail
+{
+
+struct FutureAccess
+{
+	template <class T>
+	static State<T> * state(const Future<T> & future) { return future.state_; }
+};
+
+} // namespace detail
+
+//
+// the result of ThreadPool::async
+//
+// works like std::future. get() can only be called once and leaves the future
+// invalid. waiting threads sleep instead of spinning
+//
+// then() attaches a continuation which the pool runs once the result is ready,
+// without anybody having to wait for it:
+//``````````````````````````````````````````````````````````````````````````````
+//	auto parsed =
+//		pool.async(read_file, path)
+//			.then([](rtw::Future<std::string> text) { return parse(text.get()); });
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+template <class T>
+class Future
+{
+
+public:
+
+	using State = detail::State<T>;
+
+	Future() : state_(nullptr) {}
+
+	//
+	// takes over a reference to [state]
+	//
+	explicit Future(State * state) : state_(state) {}
+
+	Future(Future && rhs) : state_(rhs.state_) { rhs.state_ = nullptr; }
+
+	Future & operator=(Future && rhs)
+	{
+		if(this != &rhs)
+		{
+			reset();
+
+			state_ = rhs.state_;
+			rhs.state_ = nullptr;
+		}
+
+		return *this;
+	}
+
+	~Future() { reset(); }
+
+	bool valid() const { return state_ != nullptr; }
+
+	bool is_ready() const
+	{
+		check_state();
+
+		return state_->is_ready();
+	}
+
+	//
+	// true once the future is ready, if its task was cancelled instead of run.
+	// get() throws TaskCancelled
+	//
+	bool is_cancelled() const
+	{
+		check_state();
+
+		return state_->is_cancelled();
+	}
+
+	T get()
+	{
+		wait();
+
+		const Released released(state_);
+
+		state_ = nullptr;
+
+		return released.state->take();
+	}
+
+	void wait() const
+	{
+		check_state();
+
+		state_->wait();
+	}
+
+	template <class Rep, class Period>
+	std::future_status wait_for(const std::chrono::duration<Rep, Period> & timeout) const
+	{
+		return wait_until(std::chrono::steady_clock::now() + timeout);
+	}
+
+	template <class Clock, class Duration>
+	std::future_status wait_until(const std::chrono::time_point<Clock, Duration> & deadline) const
+	{
+		check_state();
+
+		return
+			state_->wait_until(deadline)
+				? std::future_status::ready
+				: std::future_status::timeout;
+	}
+
+	//
+	// f is called with this future (ready) once the result is in, on the same
+	// executor that produced it. this future is left invalid
+	//
+	template <class Function>
+	Future<result_of_t<typename std::decay<Function>::type, Future>> then(Function && f);
+
+private:
+
+	Future(const Future &) = delete;
+	Future & operator=(const Future &) = delete;
+
+	//
+	// drops the reference after get() has copied the result out
+	//
+	struct Released
+	{
+		Released(State * state) : state(state) {}
+		~Released() { state->release(); }
+
+		State * state;
+	};
+
+	void check_state() const
+	{
+		if(!state_) throw std::future_error(std::future_errc::no_state);
+	}
+
+	void reset()
+	{
+		if(state_) state_->release();
+
+		state_ = nullptr;
+	}
+
+	State * state_;
+
+friend struct detail::FutureAccess;
+
+};
+
+template <class T>
+template <class Function>
+auto Future<T>::then(Function && f) -> Future<result_of_t<typename std::decay<Function>::type, Future>>
+{
+	check_state();
+
+	using Continuation = detail::TaskState<typename std::decay<Function>::type, Future>;
+	using Result       = typename Continuation::Result;
+
+	const auto state    = state_;
+	const auto executor = state->executor();
+
+	state_ = nullptr;
+
+	const auto continuation = Continuation::make(std::forward<Function>(f), Future(state));
+
+	continuation->set_executor(executor);
+
+	Future<Result> result(continuation);
+
+	state->set_continuation(continuation, executor);
+
+	return result;
+}
+
+//
+// what when_any gives you: all the futures, and the index of one that's ready
+//
+template <class Sequence>
+struct WhenAnyResult
+{
+	std::size_t index;
+	Sequence    futures;
+};
+
+namespace detail
+{
+
+template <class T, class Function>
+void for_each_future(std::vector<Future<T>> & futures, Function && f)
+{
+	for(std::size_t i = 0; i < futures.size(); i++)
+	{
+		f(i, FutureAccess::state(futures[i]));
+	}
+}
+
+template <class Function, class... Ts, std::size_t... I>
+void for_each_future(std::tuple<Future<Ts>...> & futures, Function && f, std::index_sequence<I...>)
+{
+	const int expand[] = { 0, (f(I, FutureAccess::state(std::get<I>(futures))), 0)... };
+
+	(void)expand;
+}
+
+template <class Function, class... Ts>
+void for_each_future(std::tuple<Future<Ts>...> & futures, Function && f)
+{
+	for_each_future(futures, f, std::index_sequence_for<Ts...>());
+}
+
+template <class... Ts>
+std::size_t size_of(const std::tuple<Future<Ts>...> &) { return sizeof...(Ts); }
+
+template <class T>
+std::size_t size_of(const std::vector<Future<T>> & futures) { return futures.size(); }
+
+//
+// the shared state of when_all and when_any
+//
+// it gets attached as the continuation of every input future, plus there's
+// one extra 'arrival' for the loop that does the attaching, so the result
+// can't be handed out while that loop is still looking at the inputs. every
+// arrival holds a producer reference. the arrival that finishes the
+// combinator fulfils it, the rest just drop their reference
+//
+// the inputs go back to whoever gets the result, who may well attach
+// continuations of their own, so when_any can't leave itself attached to the
+// ones that haven't finished. once the first input has fired and the attach
+// loop is done (whichever comes second), it detaches from every input that's
+// still pending, which counts as that input's arrival. an input that's
+// already finished arrives through run() as usual, so the result is only
+// handed out after complete() is done with all of them. the detach loop has
+// an arrival of its own for the same reason the attach loop does
+//
+template <class Result, class Sequence>
+class CombinatorState : public State<Result>
+{
+
+public:
+
+	enum Mode
+	{
+		ALL,
+		ANY,
+	};
+
+	static Future<Result> make(Mode mode, Sequence && futures)
+	{
+		const auto block = TaskAllocator::allocate(sizeof(CombinatorState));
+		const auto state = new (block) CombinatorState(mode, std::move(futures));
+
+		Future<Result> result(state);
+
+		state->attach();
+
+		return result;
+	}
+
+	void run() override
+	{
+		if(mode_ == ANY && !fired_.exchange(true, std::memory_order_acq_rel)) open_gate();
+
+		arrive();
+	}
+
+	void discard() override { run(); }
+
+private:
+
+	CombinatorState(Mode mode, Sequence && futures) :
+		mode_(mode),
+		futures_(std::move(futures)),
+		fired_(false)
+	{
+		const auto inputs = size_of(futures_);
+
+		//
+		// when_any's detach loop waits for the attach loop and the first
+		// input, which there isn't one of if there aren't any inputs
+		//
+		const auto arrivals =
+			mode == ALL
+				? inputs + 1
+				: inputs + 2;
+
+		pending_.store(arrivals, std::memory_order_relaxed);
+		gate_.store(inputs ? 2 : 1, std::memory_order_relaxed);
+
+		for(std::size_t i = 1; i < arrivals; i++) this->add_ref();
+	}
+
+	void attach()
+	{
+		for_each_future(
+			futures_,
+			[this](std::size_t, StateBase * input)
+			{
+				if(input) input->set_continuation(this, nullptr);
+				else run();
+			});
+
+		if(mode_ == ANY) open_gate();
+
+		arrive();
+	}
+
+	void open_gate()
+	{
+		if(gate_.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+		for_each_future(
+			futures_,
+			[this](std::size_t, StateBase * input)
+			{
+				if(input && input->detach_continuation()) arrive();
+			});
+
+		arrive();
+	}
+
+	void arrive()
+	{
+		if(pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			this->fulfil_from([this]() { return make_result(); });
+		}
+		else
+		{
+			this->release();
+		}
+	}
+
+	template <class R = Result>
+	typename std::enable_if<std::is_same<R, Sequence>::value, R>::type make_result()
+	{
+		return std::move(futures_);
+	}
+
+	template <class R = Result>
+	typename std::enable_if<!std::is_same<R, Sequence>::value, R>::type make_result()
+	{
+		auto index = std::size_t(-1);
+
+		for_each_future(
+			futures_,
+			[&index](std::size_t i, StateBase * input)
+			{
+				if(index == std::size_t(-1) && (!input || input->is_ready())) index = i;
+			});
+
+		return Result { index, std::move(futures_) };
+	}
+
+	void destroy() override
+	{
+		this->~CombinatorState();
+
+		TaskAllocator::deallocate(this, sizeof(CombinatorState));
+	}
+
+	Mode                     mode_;
+	Sequence                 futures_;
+	std::atomic<std::size_t> pending_;
+	std::atomic<std::size_t> gate_;
+	std::atomic<bool>        fired_;
+
+};
+
+} // namespace detail
+
+//
+// a future that's ready when all of [first, last) are. the futures are moved
+// out of the range and handed back in the result
+//
+template <class InputIt>
+Future<std::vector<typename std::iterator_traits<InputIt>::value_type>>
+when_all(InputIt first, InputIt last)
+{
+	using Sequence = std::vector<typename std::iterator_traits<InputIt>::value_type>;
+	using State    = detail::CombinatorState<Sequence, Sequence>;
+
+	return State::make(State::ALL, Sequence(std::make_move_iterator(first), std::make_move_iterator(last)));
+}
+
+template <class... Ts>
+Future<std::tuple<Future<Ts>...>> when_all(Future<Ts> &&... futures)
+{
+	using Sequence = std::tuple<Future<Ts>...>;
+	using State    = detail::CombinatorState<Sequence, Sequence>;
+
+	return State::make(State::ALL, Sequence(std::move(futures)...));
+}
+
+//
+// a future that's ready when any of [first, last) is. the result says which
+// one. an empty range gives a ready future with index -1
+//
+template <class InputIt>
+Future<WhenAnyResult<std::vector<typename std::iterator_traits<InputIt>::value_type>>>
+when_any(InputIt first, InputIt last)
+{
+	using Sequence = std::vector<typename std::iterator_traits<InputIt>::value_type>;
+	using State    = detail::CombinatorState<WhenAnyResult<Sequence>, Sequence>;
+
+	return State::make(State::ANY, Sequence(std::make_move_iterator(first), std::make_move_iterator(last)));
+}
+
+template <class... Ts>
+Future<WhenAnyResult<std::tuple<Future<Ts>...>>> when_any(Future<Ts> &&... futures)
+{
+	using Sequence = std::tuple<Future<Ts>...>;
+	using State    = detail::CombinatorState<WhenAnyResult<Sequence>, Sequence>;
+
+	return State::make(State::ANY, Sequence(std::move(futures)...));
+}
+
+} // namespace rtw
@@ -1,17 +1,36 @@
 #pragma once
 
 #include <future>
+#include <utility>
 
 namespace rtw
 {
 
+//
+// what you get from calling a Function with Args. std::result_of is
+// deprecated in C++17 and gone in C++20
+//
 template <class Function, class... Args>
-using future_of = std::future<typename std::result_of<Function(Args...)>::type>;
+using result_of_t = decltype(std::declval<Function>()(std::declval<Args>()...));
+
+template <class Function, class... Args>
+using future_of = std::future<result_of_t<Function, Args...>>;
+
+template <class T> class Future;
 
 template <class T>
 bool is_ready(const std::future<T> & f)
 {
 	return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
 }
+
+//
+// rtw::Futures know whether they're ready without having to wait for anything
+//
+template <class T>
+bool is_ready(const Future<T> & f)
+{
+	return f.is_ready();
+}
 	
 } // namespace rtw
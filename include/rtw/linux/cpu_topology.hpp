@@ -0,0 +1,181 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// included from rtw/cpu_topology.hpp, which defines Cpu and parse_cpu_list
+// before it gets here
+//
+
+namespace rtw
+{
+
+namespace cpu
+{
+
+namespace detail
+{
+
+//
+// the whole file, or an empty string if it can't be read
+//
+inline std::string read_sysfs(const std::string & path)
+{
+	std::ifstream file(path);
+
+	if(!file) return std::string();
+
+	std::stringstream contents;
+
+	contents << file.rdbuf();
+
+	return contents.str();
+}
+
+inline int read_sysfs_int(const std::string & path, int fallback)
+{
+	const auto contents = read_sysfs(path);
+
+	char * end;
+
+	const auto value = std::strtol(contents.c_str(), &end, 10);
+
+	return end == contents.c_str() ? fallback : int(value);
+}
+
+//
+// lowest cpu in a cpu list file
+//
+inline int read_sysfs_first_cpu(const std::string & path, int fallback)
+{
+	const auto cpus = parse_cpu_list(read_sysfs(path));
+
+	return cpus.empty() ? fallback : cpus.front();
+}
+
+//
+// the lowest cpu sharing the highest level data/unified cache with [cpu]
+//
+inline int read_llc(const std::string & cpu_dir, int fallback)
+{
+	auto llc       = fallback;
+	auto llc_level = 0;
+
+	for(int index = 0;; index++)
+	{
+		const auto dir = cpu_dir + "/cache/index" + std::to_string(index);
+
+		const auto level = read_sysfs_int(dir + "/level", -1);
+
+		if(level < 0) break;
+
+		if(read_sysfs(dir + "/type").compare(0, 11, "Instruction") == 0) continue;
+
+		if(level > llc_level)
+		{
+			llc_level = level;
+			llc       = read_sysfs_first_cpu(dir + "/shared_cpu_list", fallback);
+		}
+	}
+
+	return llc;
+}
+
+//
+// online cpus we're allowed to run on, straight out of sysfs. anything sysfs
+// doesn't tell us (containers sometimes hide bits of it) falls back to
+// 'every cpu is its own core, on node 0'
+//
+inline std::vector<Cpu> read_cpus()
+{
+	const std::string cpu_root  = "/sys/devices/system/cpu";
+	const std::string node_root = "/sys/devices/system/node";
+
+	auto online = parse_cpu_list(read_sysfs(cpu_root + "/online"));
+
+	if(online.empty())
+	{
+		const auto count = std::max(1, int(std::thread::hardware_concurrency()));
+
+		for(int i = 0; i < count; i++) online.push_back(i);
+	}
+
+	cpu_set_t allowed;
+
+	CPU_ZERO(&allowed);
+
+	const auto have_allowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	std::vector<Cpu> cpus;
+
+	for(const auto id : online)
+	{
+		if(have_allowed && id < CPU_SETSIZE && !CPU_ISSET(id, &allowed)) continue;
+
+		const auto dir = cpu_root + "/cpu" + std::to_string(id);
+
+		Cpu cpu;
+
+		cpu.id      = id;
+		cpu.core    = read_sysfs_first_cpu(dir + "/topology/thread_siblings_list", id);
+		cpu.package = read_sysfs_int(dir + "/topology/physical_package_id", 0);
+		cpu.llc     = read_llc(dir, cpu.core);
+		cpu.node    = 0;
+
+		cpus.push_back(cpu);
+	}
+
+	for(const auto node : parse_cpu_list(read_sysfs(node_root + "/online")))
+	{
+		const auto path = node_root + "/node" + std::to_string(node) + "/cpulist";
+
+		for(const auto id : parse_cpu_list(read_sysfs(path)))
+		{
+			for(auto & cpu : cpus)
+			{
+				if(cpu.id == id) cpu.node = node;
+			}
+		}
+	}
+
+	return cpus;
+}
+
+} // namespace detail
+
+//
+// restricts the calling thread to [cpus]. returns false if the kernel said no
+// (or there's nothing in [cpus] it could use)
+//
+inline bool pin_current_thread(const std::vector<int> & cpus)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+
+	auto any = false;
+
+	for(const auto cpu : cpus)
+	{
+		if(cpu < 0 || cpu >= CPU_SETSIZE) continue;
+
+		CPU_SET(cpu, &set);
+
+		any = true;
+	}
+
+	return any && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+} // namespace cpu
+
+} // namespace rtw
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <rtw/error.hpp>
+
+//
+// included from rtw/event_fd.hpp
+//
+
+namespace rtw
+{
+
+inline EventFd::EventFd() :
+	read_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+	write_fd_(read_fd_)
+{
+	if(read_fd_ < 0)
+	{
+		throw std::runtime_error(error::failed_to_do_x("create an eventfd", std::strerror(errno)));
+	}
+}
+
+inline EventFd::~EventFd()
+{
+	close(read_fd_);
+}
+
+//
+// the counter can't overflow at one per set(), and if it's already set the
+// write is harmless
+//
+inline void EventFd::set()
+{
+	const std::uint64_t one = 1;
+
+	while(write(write_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+//
+// reading an eventfd zeroes it. EAGAIN just means it wasn't set
+//
+inline void EventFd::clear()
+{
+	std::uint64_t count;
+
+	while(read(read_fd_, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
+
+} // namespace rtw
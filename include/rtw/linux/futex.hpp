@@ -0,0 +1,85 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+
+//
+// included from rtw/futex.hpp
+//
+
+namespace rtw
+{
+
+namespace detail
+{
+
+static_assert(
+	sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+	"a futex word has to be a plain 32 bit integer");
+
+inline long futex(std::atomic<std::uint32_t> & word, const int op, const std::uint32_t value, const timespec * timeout)
+{
+	return syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), op, value, timeout, nullptr, 0);
+}
+
+inline void futex_wait(std::atomic<std::uint32_t> & word, const std::uint32_t expected)
+{
+	futex(word, FUTEX_WAIT_PRIVATE, expected, nullptr);
+}
+
+//
+// FUTEX_WAIT takes a relative timeout
+//
+inline void futex_wait_for(std::atomic<std::uint32_t> & word, const std::uint32_t expected, const std::chrono::nanoseconds timeout)
+{
+	if(timeout.count() <= 0) return;
+
+	timespec relative;
+
+	relative.tv_sec  = static_cast<time_t>(timeout.count() / 1000000000);
+	relative.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+
+	futex(word, FUTEX_WAIT_PRIVATE, expected, &relative);
+}
+
+inline void futex_wake(std::atomic<std::uint32_t> & word, const int count)
+{
+	futex(word, FUTEX_WAKE_PRIVATE, static_cast<std::uint32_t>(count), nullptr);
+}
+
+inline void futex_wake_all(std::atomic<std::uint32_t> & word)
+{
+	futex_wake(word, INT_MAX);
+}
+
+//
+// the non-private ops key the futex on the page rather than the address, so
+// they work on a word mapped into several processes
+//
+inline void futex_wait_shared(std::atomic<std::uint32_t> & word, const std::uint32_t expected, const std::chrono::nanoseconds timeout)
+{
+	if(timeout.count() <= 0) return;
+
+	timespec relative;
+
+	relative.tv_sec  = static_cast<time_t>(timeout.count() / 1000000000);
+	relative.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+
+	futex(word, FUTEX_WAIT, expected, &relative);
+}
+
+inline void futex_wake_shared(std::atomic<std::uint32_t> & word)
+{
+	futex(word, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+} // namespace detail
+
+} // namespace rtw
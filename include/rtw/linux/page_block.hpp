@@ -0,0 +1,84 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <new>
+
+//
+// included from rtw/page_block.hpp, which defines PageBlock before it gets
+// here
+//
+
+namespace rtw
+{
+
+namespace detail
+{
+
+static constexpr std::size_t HUGE_PAGE_SIZE = std::size_t(2) << 20;
+
+inline void * map_anonymous(const std::size_t size, const int extra_flags)
+{
+	const auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+
+	return data == MAP_FAILED ? nullptr : data;
+}
+
+} // namespace detail
+
+inline PageBlock::PageBlock(const std::size_t size, const bool huge_pages) :
+	data_(nullptr),
+	size_(size),
+	mapped_(0),
+	huge_(false)
+{
+	if(huge_pages)
+	{
+		const auto rounded = (size + detail::HUGE_PAGE_SIZE - 1) & ~(detail::HUGE_PAGE_SIZE - 1);
+
+#if defined(MAP_HUGETLB)
+		data_ = detail::map_anonymous(rounded, MAP_HUGETLB);
+
+		if(data_)
+		{
+			mapped_ = rounded;
+			huge_   = true;
+
+			return;
+		}
+#endif
+
+		//
+		// transparent huge pages only get used for whole, aligned huge
+		// pages, so map it rounded up
+		//
+		data_ = detail::map_anonymous(rounded, 0);
+
+		if(data_)
+		{
+			mapped_ = rounded;
+
+#if defined(MADV_HUGEPAGE)
+			huge_ = madvise(data_, rounded, MADV_HUGEPAGE) == 0;
+#endif
+
+			return;
+		}
+	}
+
+	data_ = detail::map_anonymous(size, 0);
+
+	if(!data_) throw std::bad_alloc();
+
+	mapped_ = size;
+}
+
+inline void PageBlock::reset()
+{
+	if(data_) munmap(data_, mapped_);
+
+	data_ = nullptr;
+}
+
+} // namespace rtw
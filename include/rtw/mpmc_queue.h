@@ -0,0 +1,376 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <rtw/meta.hpp>
+#include <rtw/parking_lot.h>
+#include <rtw/sync_queue.h>
+
+namespace rtw
+{
+
+//
+// a bounded multi-producer multi-consumer queue with no locks in it
+//
+// every slot carries a sequence number that says whose turn it is: a producer
+// owns slot i when its sequence is i, a consumer when it's i + 1. claiming a
+// slot is one compare-and-swap on the tail (or head), and neither side ever
+// waits for the other, so a thread stalled in the middle of a push only holds
+// up the consumer that wants that one slot
+//
+// slots are padded out to whole cache lines and the head and tail have lines
+// of their own, so producers and consumers on different slots don't bounce
+// each other's cache lines around
+//
+// try_push and try_pop never block. see MpmcQueue for something that waits
+//
+// see Dmitry Vyukov's "Bounded MPMC queue" for where this comes from
+//
+template <class T>
+class MpmcRing : private meta::NoCopy
+{
+
+	static_assert(
+		std::is_nothrow_move_constructible<T>::value &&
+		std::is_nothrow_move_assignable<T>::value,
+		"MpmcRing items have to be nothrow movable");
+
+	static_assert(
+		alignof(T) <= detail::CACHE_LINE,
+		"MpmcRing items can't be aligned to more than a cache line");
+
+public:
+
+	//
+	// the capacity gets rounded up to a power of two
+	//
+	explicit MpmcRing(std::size_t capacity = 1024);
+	~MpmcRing();
+
+	//
+	// false (and [value] is left alone) if the ring is full
+	//
+	bool try_push(T && value);
+
+	//
+	// false if the ring is empty
+	//
+	bool try_pop(T & value);
+
+	//
+	// only a snapshot, it may be out of date by the time you look at it
+	//
+	std::size_t size() const;
+
+	std::size_t capacity() const { return mask_ + 1; }
+
+private:
+
+	struct Slot
+	{
+		std::atomic<std::size_t>                                    sequence;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	static constexpr std::size_t SLOT_SIZE =
+		(sizeof(Slot) + detail::CACHE_LINE - 1) / detail::CACHE_LINE * detail::CACHE_LINE;
+
+	Slot & slot(std::size_t position) const
+	{
+		return *reinterpret_cast<Slot *>(slots_ + (position & mask_) * SLOT_SIZE);
+	}
+
+	static T & item(Slot & slot) { return *reinterpret_cast<T *>(&slot.storage); }
+
+	//
+	// slots_ is block_ rounded up to a cache line
+	//
+	std::unique_ptr<char[]>  block_;
+	char *                   slots_;
+	std::size_t              mask_;
+
+	char                     pad0_[detail::CACHE_LINE];
+	std::atomic<std::size_t> tail_;
+	char                     pad1_[detail::CACHE_LINE - sizeof(std::atomic<std::size_t>)];
+	std::atomic<std::size_t> head_;
+	char                     pad2_[detail::CACHE_LINE - sizeof(std::atomic<std::size_t>)];
+
+};
+
+template <class T> MpmcRing<T>::MpmcRing(std::size_t capacity) :
+	mask_(0),
+	tail_(0),
+	head_(0)
+{
+	std::size_t pow2 = 2;
+
+	while(pow2 < capacity) pow2 <<= 1;
+
+	mask_ = pow2 - 1;
+
+	block_.reset(new char[pow2 * SLOT_SIZE + detail::CACHE_LINE]);
+
+	const auto address = reinterpret_cast<std::uintptr_t>(block_.get());
+	const auto aligned = (address + detail::CACHE_LINE - 1) & ~std::uintptr_t(detail::CACHE_LINE - 1);
+
+	slots_ = block_.get() + (aligned - address);
+
+	for(std::size_t i = 0; i < pow2; i++)
+	{
+		new (&slot(i)) Slot();
+
+		slot(i).sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+template <class T> MpmcRing<T>::~MpmcRing()
+{
+	T value;
+
+	while(try_pop(value)) {}
+
+	for(std::size_t i = 0; i <= mask_; i++) slot(i).~Slot();
+}
+
+template <class T> bool MpmcRing<T>::try_push(T && value)
+{
+	auto position = tail_.load(std::memory_order_relaxed);
+
+	for(;;)
+	{
+		auto & s = slot(position);
+
+		const auto sequence = s.sequence.load(std::memory_order_acquire);
+		const auto diff     = std::intptr_t(sequence) - std::intptr_t(position);
+
+		if(diff == 0)
+		{
+			if(tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				new (&s.storage) T(std::move(value));
+
+				s.sequence.store(position + 1, std::memory_order_release);
+
+				return true;
+			}
+		}
+		else if(diff < 0)
+		{
+			//
+			// the consumer from one lap ago hasn't taken this slot yet
+			//
+			return false;
+		}
+		else
+		{
+			position = tail_.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <class T> bool MpmcRing<T>::try_pop(T & value)
+{
+	auto position = head_.load(std::memory_order_relaxed);
+
+	for(;;)
+	{
+		auto & s = slot(position);
+
+		const auto sequence = s.sequence.load(std::memory_order_acquire);
+		const auto diff     = std::intptr_t(sequence) - std::intptr_t(position + 1);
+
+		if(diff == 0)
+		{
+			if(head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				auto & stored = item(s);
+
+				value = std::move(stored);
+
+				stored.~T();
+
+				//
+				// hand the slot to the producer one lap ahead
+				//
+				s.sequence.store(position + mask_ + 1, std::memory_order_release);
+
+				return true;
+			}
+		}
+		else if(diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			position = head_.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <class T> std::size_t MpmcRing<T>::size() const
+{
+	const auto head = head_.load(std::memory_order_relaxed);
+	const auto tail = tail_.load(std::memory_order_relaxed);
+
+	return tail > head ? tail - head : 0;
+}
+
+//
+// an MpmcRing with SyncQueue's push/pop/kill, for when a consumer wants to
+// wait for something to turn up (or a producer for room)
+//
+// waiting threads spin for a bit first, since under load something usually
+// comes along within a few hundred nanoseconds, then park (see
+// detail::Waiters)
+//
+// unlike SyncQueue it's bounded, so push() waits while the queue is full. a
+// value that's still waiting when the queue is killed is thrown away
+//
+template <class T>
+class MpmcQueue : private meta::NoCopy
+{
+
+public:
+
+	using Result = SyncQueueResult<T>;
+
+	explicit MpmcQueue(std::size_t capacity = 1024);
+
+	void kill();
+	void push(T && value);
+	bool try_push(T && value);
+
+	template <class Iterator>
+	void push_range(Iterator first, Iterator last);
+
+	Result pop();
+	Result try_pop();
+
+	std::size_t size() const { return ring_.size(); }
+	std::size_t capacity() const { return ring_.capacity(); }
+
+private:
+
+	MpmcRing<T>       ring_;
+	std::atomic<bool> dying_;
+
+	//
+	// consumers waiting for an item and producers waiting for room
+	//
+	detail::Waiters   pops_;
+	detail::Waiters   pushes_;
+
+};
+
+template <class T> MpmcQueue<T>::MpmcQueue(std::size_t capacity) :
+	ring_(capacity),
+	dying_(false)
+{
+}
+
+//
+// wakes everybody waiting in push() or pop(). pop() returns a 'dead' result
+// from then on
+//
+template <class T> void MpmcQueue<T>::kill()
+{
+	dying_.store(true, std::memory_order_seq_cst);
+
+	pops_.notify_all();
+	pushes_.notify_all();
+}
+
+template <class T> bool MpmcQueue<T>::try_push(T && value)
+{
+	if(!ring_.try_push(std::move(value))) return false;
+
+	pops_.notify();
+
+	return true;
+}
+
+template <class T> void MpmcQueue<T>::push(T && value)
+{
+	auto pushed = false;
+
+	pushes_.wait([this, &value, &pushed]()
+	{
+		pushed = ring_.try_push(std::move(value));
+
+		return pushed || dying_.load(std::memory_order_acquire);
+	});
+
+	if(pushed) pops_.notify();
+}
+
+//
+// only wakes consumers once, at the end, unless it has to wait for room
+//
+template <class T>
+template <class Iterator>
+void MpmcQueue<T>::push_range(Iterator first, Iterator last)
+{
+	auto pushed = false;
+
+	for(; first != last; ++first)
+	{
+		T value(std::move(*first));
+
+		if(ring_.try_push(std::move(value)))
+		{
+			pushed = true;
+
+			continue;
+		}
+
+		if(pushed) pops_.notify();
+
+		pushed = false;
+
+		push(std::move(value));
+	}
+
+	if(pushed) pops_.notify();
+}
+
+template <class T> auto MpmcQueue<T>::pop() -> Result
+{
+	T value;
+
+	auto popped = false;
+
+	pops_.wait([this, &value, &popped]()
+	{
+		if(dying_.load(std::memory_order_acquire)) return true;
+
+		popped = ring_.try_pop(value);
+
+		return popped;
+	});
+
+	if(!popped) return Result();
+
+	pushes_.notify();
+
+	return Result(std::move(value));
+}
+
+template <class T> auto MpmcQueue<T>::try_pop() -> Result
+{
+	T value;
+
+	if(dying_.load(std::memory_order_acquire) || !ring_.try_pop(value)) return Result();
+
+	pushes_.notify();
+
+	return Result(std::move(value));
+}
+
+} // namespace rtw
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "meta.hpp"
+
+namespace rtw
+{
+
+//
+// a big zeroed block of memory straight from the OS, for buffers that are
+// allocated once and hammered for a long time (queue rings and the like)
+//
+// with huge_pages it asks for huge pages first: explicit ones (which only
+// work if the admin has set some aside) and then transparent ones. if it can't
+// get them it quietly uses normal pages, see huge()
+//
+class PageBlock : private meta::NoCopy
+{
+
+public:
+
+	PageBlock() :
+		data_(nullptr),
+		size_(0),
+		mapped_(0),
+		huge_(false)
+	{
+	}
+
+	PageBlock(std::size_t size, bool huge_pages);
+
+	PageBlock(PageBlock && rhs) :
+		data_(rhs.data_),
+		size_(rhs.size_),
+		mapped_(rhs.mapped_),
+		huge_(rhs.huge_)
+	{
+		rhs.data_   = nullptr;
+		rhs.size_   = 0;
+		rhs.mapped_ = 0;
+	}
+
+	PageBlock & operator=(PageBlock && rhs)
+	{
+		if(this != &rhs)
+		{
+			reset();
+
+			data_   = rhs.data_;
+			size_   = rhs.size_;
+			mapped_ = rhs.mapped_;
+			huge_   = rhs.huge_;
+
+			rhs.data_   = nullptr;
+			rhs.size_   = 0;
+			rhs.mapped_ = 0;
+		}
+
+		return *this;
+	}
+
+	~PageBlock() { reset(); }
+
+	void * data() const { return data_; }
+	std::size_t size() const { return size_; }
+
+	//
+	// true if the block really is backed by huge pages (as far as we can
+	// tell. transparent huge pages are only a request)
+	//
+	bool huge() const { return huge_; }
+
+private:
+
+	void reset();
+
+	void *      data_;
+	std::size_t size_;
+
+	//
+	// what actually got mapped, which can be more than size_
+	//
+	std::size_t mapped_;
+	bool        huge_;
+
+};
+
+} // namespace rtw
+
+#if defined(__linux__)
+
+#include "linux/page_block.hpp"
+
+#else
+
+#include <cstring>
+
+namespace rtw
+{
+
+//
+// no pages to ask for, so it's just the heap, lined up to a cache line
+//
+inline PageBlock::PageBlock(const std::size_t size, bool) :
+	size_(size),
+	mapped_(size + 64),
+	huge_(false)
+{
+	const auto block   = static_cast<char *>(::operator new(mapped_));
+	const auto address = reinterpret_cast<std::uintptr_t>(block);
+	const auto offset  = ((address + 63) & ~std::uintptr_t(63)) - address;
+
+	std::memset(block, 0, mapped_);
+
+	//
+	// the offset goes in the byte before the data so reset() can find the
+	// start again. it's never zero, there's always at least one byte free
+	//
+	data_ = block + (offset == 0 ? 64 : offset);
+
+	static_cast<unsigned char *>(data_)[-1] = static_cast<unsigned char>(offset == 0 ? 64 : offset);
+}
+
+inline void PageBlock::reset()
+{
+	if(data_)
+	{
+		const auto bytes = static_cast<unsigned char *>(data_);
+
+		::operator delete(bytes - bytes[-1]);
+	}
+
+	data_ = nullptr;
+}
+
+} // namespace rtw
+
+#endif
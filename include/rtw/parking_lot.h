@@ -0,0 +1,198 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// a fixed table of mutex/condition variable pairs that threads can park on,
+// keyed by the address of whatever they're waiting for
+//
+// this means the thing being waited on doesn't have to carry its own mutex
+// and condition variable around, it only needs a bit saying somebody is
+// parked on it so the waker knows whether to bother
+//
+// waking a bucket wakes everybody parked in it, including threads waiting on
+// something else that hashed to the same bucket. they just re-check and go
+// back to sleep
+//
+class ParkingLot
+{
+
+public:
+
+	struct Bucket
+	{
+		std::mutex              mutex;
+		std::condition_variable cond;
+	};
+
+	static Bucket & bucket_for(const void * address)
+	{
+		static Bucket buckets[NUM_BUCKETS];
+
+		auto key = reinterpret_cast<std::uintptr_t>(address);
+
+		key ^= key >> 9;
+		key ^= key >> 17;
+
+		return buckets[key % NUM_BUCKETS];
+	}
+
+	//
+	// doesn't dereference [address] so it's fine to call after the thing at
+	// [address] might have been destroyed
+	//
+	static void unpark_all(const void * address)
+	{
+		auto & bucket = bucket_for(address);
+
+		std::lock_guard<std::mutex> lock(bucket.mutex);
+
+		bucket.cond.notify_all();
+	}
+
+private:
+
+	static constexpr std::size_t NUM_BUCKETS = 64;
+
+};
+
+static constexpr std::size_t CACHE_LINE = 64;
+
+//
+// tells the cpu we're spinning so it can go easy on the other hyperthread
+//
+inline void spin_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+//
+// how many times a waiting thread tries again before it parks. on a single
+// cpu there's nobody running to spin for, so it parks straight away
+//
+inline int spin_limit()
+{
+	static const int limit = std::thread::hardware_concurrency() > 1 ? 100 : 0;
+
+	return limit;
+}
+
+//
+// the threads waiting for one kind of change to one object (a queue getting
+// an item, say), parked on the ParkingLot under this object's address
+//
+// the side making the change only touches the parking lot if somebody is
+// actually parked
+//
+class Waiters
+{
+
+public:
+
+	Waiters() : parked_(0) {}
+
+	//
+	// spins, then parks, until ready() returns true. ready() is called over
+	// and over (sometimes with a parking lot mutex held), and can do the
+	// work it's waiting to do, like popping the item it's waiting for
+	//
+	template <class Ready>
+	void wait(Ready && ready);
+
+	//
+	// call after making a change somebody might be waiting for
+	//
+	void notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if(parked_.load(std::memory_order_relaxed) > 0)
+		{
+			ParkingLot::unpark_all(this);
+		}
+	}
+
+	//
+	// the same, for when the change was itself a seq_cst store (or
+	// read-modify-write). that already does the fence's job, and on x86 it's
+	// a good deal cheaper than a store plus a fence
+	//
+	void notify_after_seq_cst()
+	{
+		if(parked_.load(std::memory_order_seq_cst) > 0)
+		{
+			ParkingLot::unpark_all(this);
+		}
+	}
+
+	//
+	// wakes everybody whether it looks like anybody's there or not
+	//
+	void notify_all() { ParkingLot::unpark_all(this); }
+
+private:
+
+	Waiters(const Waiters &) = delete;
+	Waiters & operator=(const Waiters &) = delete;
+
+	std::atomic<int> parked_;
+
+};
+
+//
+// parked_ is bumped before the last look, and notifiers make their change
+// before they look at parked_, so either we see the change or they see us.
+// they have to take the bucket's mutex to wake us, so they can't slip in
+// between our last look and the wait either
+//
+template <class Ready>
+void Waiters::wait(Ready && ready)
+{
+	for(int spin = 0; spin < spin_limit(); spin++)
+	{
+		if(ready()) return;
+
+		spin_pause();
+	}
+
+	auto & bucket = ParkingLot::bucket_for(this);
+
+	std::unique_lock<std::mutex> lock(bucket.mutex);
+
+	for(;;)
+	{
+		parked_.fetch_add(1, std::memory_order_seq_cst);
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if(ready())
+		{
+			parked_.fetch_sub(1, std::memory_order_relaxed);
+
+			return;
+		}
+
+		bucket.cond.wait(lock);
+
+		parked_.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+} // namespace detail
+
+} // namespace rtw
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+
+#include <rtw/event_fd.hpp>
+#include <rtw/sync_queue.h>
+
+namespace rtw
+{
+
+//
+// a SyncQueue with a file descriptor that's readable whenever there's
+// something to pop (or the queue has been killed), so a thread running an
+// epoll loop can wait for the queue along with its sockets and timers
+// instead of blocking in pop():
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::PollableQueue<Reply> replies;
+//
+//	epoll_event event = {};
+//
+//	event.events  = EPOLLIN;
+//	event.data.fd = replies.fd();
+//
+//	epoll_ctl(epoll, EPOLL_CTL_ADD, replies.fd(), &event);
+//
+//	// and when epoll_wait says it's readable
+//	for(int i = 0; i < 64; i++)
+//	{
+//		auto reply = replies.try_pop();
+//
+//		if(!reply) break;
+//
+//		send(reply.get());
+//	}
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+// it's level triggered: the fd is set when the queue goes from empty to not
+// empty and cleared when a pop empties it, both under the queue's lock. so a
+// burst of pushes costs one eventfd write however big it is, a consumer that
+// stops early (like the one above) gets told again on the next epoll_wait,
+// and nobody ever reads the fd themselves. with EPOLLET you have to keep
+// popping until try_pop comes back empty
+//
+// everything else is plain SyncQueue, including the bounded and Wait modes.
+// it can't also go in a QueueSelector
+//
+template <class T>
+class PollableQueue : public SyncQueue<T>, private detail::QueueWatcher
+{
+
+public:
+
+	PollableQueue() :
+		set_(false)
+	{
+		this->watch(this);
+	}
+
+	explicit PollableQueue(Wait wait) :
+		SyncQueue<T>(wait),
+		set_(false)
+	{
+		this->watch(this);
+	}
+
+	explicit PollableQueue(std::size_t capacity, Overflow overflow = Overflow::Block, Wait wait = Wait::Sleep) :
+		SyncQueue<T>(capacity, overflow, wait),
+		set_(false)
+	{
+		this->watch(this);
+	}
+
+	~PollableQueue() { this->watch(nullptr); }
+
+	int fd() const { return event_.fd(); }
+
+private:
+
+	void queue_ready() override
+	{
+		if(set_) return;
+
+		event_.set();
+
+		set_ = true;
+	}
+
+	void queue_drained() override
+	{
+		if(!set_) return;
+
+		event_.clear();
+
+		set_ = false;
+	}
+
+	EventFd event_;
+
+	//
+	// whether event_ is set, so it's only written and read when that
+	// changes. goes with the queue's lock
+	//
+	bool    set_;
+
+};
+
+} // namespace rtw
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <rtw/future.h>
+#include <rtw/ring_buffer.h>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// the high and low priority lanes of a ThreadPool. normal priority work
+// doesn't come through here, it uses the pool's usual queues
+//
+// the high lane is ordered by deadline (earliest first). plain high priority
+// tasks use their submission time as the deadline, so among themselves
+// they're FIFO and they go ahead of deadline tasks that aren't due yet. the
+// low lane is FIFO
+//
+class PriorityLanes : private meta::NoCopy
+{
+
+public:
+
+	using Clock     = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+
+	enum Lane
+	{
+		HIGH,
+		LOW,
+		NUM_LANES,
+	};
+
+	PriorityLanes() :
+		next_sequence_(0),
+		size_(0)
+	{
+		for(auto & size : lane_sizes_) size.store(0, std::memory_order_relaxed);
+	}
+
+	void push_high(Task * task, TimePoint deadline);
+	void push_low(Task * task);
+
+	//
+	// returns nullptr if [lane] is empty
+	//
+	Task * pop(Lane lane);
+
+	//
+	// [first] if it has anything, otherwise the other lane
+	//
+	Task * pop_any(Lane first);
+
+	//
+	// cheap enough to call before every pop
+	//
+	bool empty() const { return size_.load(std::memory_order_relaxed) == 0; }
+
+	std::size_t size(Lane lane) const
+	{
+		return lane_sizes_[lane].load(std::memory_order_relaxed);
+	}
+
+	void discard_all();
+
+private:
+
+	struct Entry
+	{
+		TimePoint     deadline;
+		std::uint64_t sequence;
+		Task *        task;
+
+		//
+		// std heaps are max-heaps, so 'less' means 'due later'
+		//
+		bool operator<(const Entry & rhs) const
+		{
+			return
+				deadline != rhs.deadline
+					? deadline > rhs.deadline
+					: sequence > rhs.sequence;
+		}
+	};
+
+	void pushed(Lane lane)
+	{
+		lane_sizes_[lane].fetch_add(1, std::memory_order_relaxed);
+		size_.fetch_add(1, std::memory_order_release);
+	}
+
+	void popped(Lane lane)
+	{
+		lane_sizes_[lane].fetch_sub(1, std::memory_order_relaxed);
+		size_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	std::mutex               mutex_;
+	std::vector<Entry>       high_;
+	RingBuffer<Task *>       low_;
+	std::uint64_t            next_sequence_;
+	std::atomic<std::size_t> size_;
+	std::atomic<std::size_t> lane_sizes_[NUM_LANES];
+
+};
+
+inline void PriorityLanes::push_high(Task * const task, const TimePoint deadline)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		high_.push_back(Entry { deadline, next_sequence_++, task });
+
+		std::push_heap(high_.begin(), high_.end());
+	}
+
+	pushed(HIGH);
+}
+
+inline void PriorityLanes::push_low(Task * const task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		low_.emplace_back(task);
+	}
+
+	pushed(LOW);
+}
+
+inline Task * PriorityLanes::pop(const Lane lane)
+{
+	if(size(lane) == 0) return nullptr;
+
+	Task * task = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if(lane == HIGH && !high_.empty())
+		{
+			std::pop_heap(high_.begin(), high_.end());
+
+			task = high_.back().task;
+
+			high_.pop_back();
+		}
+		else if(lane == LOW && !low_.empty())
+		{
+			task = low_.front();
+
+			low_.pop_front();
+		}
+	}
+
+	if(task) popped(lane);
+
+	return task;
+}
+
+inline Task * PriorityLanes::pop_any(const Lane first)
+{
+	const auto task = pop(first);
+
+	return task ? task : pop(first == HIGH ? LOW : HIGH);
+}
+
+inline void PriorityLanes::discard_all()
+{
+	Task * task;
+
+	while((task = pop_any(HIGH)) != nullptr)
+	{
+		task->discard();
+	}
+}
+
+} // namespace detail
+
+} // namespace rtw
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <rtw/meta.hpp>
+#include <rtw/sync_queue.h>
+
+namespace rtw
+{
+
+//
+// waits on a bunch of SyncQueues at once, like select/poll does for sockets,
+// so one thread can serve many mostly idle queues instead of having a thread
+// blocked in pop() on each
+//
+// wait() blocks until at least one queue has something in it (or has been
+// killed) and hands back the indices add() gave out for the ones that are
+// ready. the queues can hold different types. pop from them with try_pop,
+// since another consumer may have got there first
+//
+// with Fairness::RoundRobin the list starts one further along each time, so
+// if you take a fixed number of values from each ready queue per round a hot
+// queue can't starve the others:
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::QueueSelector selector;
+//
+//	const auto orders = selector.add(order_queue);
+//	const auto quotes = selector.add(quote_queue);
+//
+//	for(;;)
+//	{
+//		for(const auto ready : selector.wait())
+//		{
+//			for(int i = 0; i < 32; i++)
+//			{
+//				if(ready == orders)
+//				{
+//					auto order = order_queue.try_pop();
+//
+//					if(!order) break;
+//
+//					route(order.get());
+//				}
+//				...
+//			}
+//		}
+//	}
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+// a killed queue is always ready (its try_pop keeps coming back dead), so
+// remove() it once you're done with it
+//
+// only one thread should add, remove and wait. producers pushing into the
+// queues don't need to know about the selector. a queue can only be in one
+// selector at a time (and only once), and has to outlive it (or be removed
+// first)
+//
+class QueueSelector : private meta::NoCopy, private detail::QueueWatcher
+{
+
+public:
+
+	using Deadline = std::chrono::steady_clock::time_point;
+
+	enum class Fairness
+	{
+		//
+		// the ready list starts after where the last one started
+		//
+		RoundRobin,
+
+		//
+		// the ready list is always in index order, so earlier queues come
+		// first. for when one queue (control messages, say) should always
+		// be served first
+		//
+		InOrder,
+	};
+
+	explicit QueueSelector(Fairness fairness = Fairness::RoundRobin) :
+		fairness_(fairness),
+		next_(0),
+		generation_(0),
+		waiting_(false)
+	{
+	}
+
+	~QueueSelector();
+
+	//
+	// returns the queue's index, which is what wait() hands back. indices
+	// aren't reused after remove()
+	//
+	template <class T>
+	std::size_t add(SyncQueue<T> & queue);
+
+	void remove(std::size_t index);
+
+	//
+	// the ready queues' indices, never empty
+	//
+	std::vector<std::size_t> wait() { return wait_until(Deadline::max()); }
+
+	//
+	// these come back empty if nothing was ready in time
+	//
+	template <class Rep, class Period>
+	std::vector<std::size_t> wait_for(const std::chrono::duration<Rep, Period> & timeout)
+	{
+		return wait_until(std::chrono::steady_clock::now() + timeout);
+	}
+
+	std::vector<std::size_t> wait_until(Deadline deadline);
+
+	//
+	// doesn't wait at all
+	//
+	std::vector<std::size_t> poll();
+
+private:
+
+	struct Entry
+	{
+		std::function<bool()>                       readable;
+		std::function<void(detail::QueueWatcher *)> watch;
+	};
+
+	void queue_ready() override;
+
+	Fairness           fairness_;
+	std::vector<Entry> entries_;
+	std::size_t        next_;
+
+	//
+	// bumped by queue_ready(), so wait can tell if something happened while
+	// it was looking at the queues
+	//
+	std::mutex              mutex_;
+	std::condition_variable cond_;
+	std::uint64_t           generation_;
+	bool                    waiting_;
+
+	static constexpr auto ERR_QUEUE_SELECTOR_BAD_INDEX =
+		"a bad programmer tried to remove a queue from a selector it "
+		"isn't in"
+		;
+
+};
+
+inline QueueSelector::~QueueSelector()
+{
+	for(auto & entry : entries_)
+	{
+		if(entry.watch) entry.watch(nullptr);
+	}
+}
+
+template <class T>
+std::size_t QueueSelector::add(SyncQueue<T> & queue)
+{
+	Entry entry;
+
+	entry.readable = [&queue]() { return queue.readable(); };
+	entry.watch    = [&queue](detail::QueueWatcher * watcher) { queue.watch(watcher); };
+
+	entry.watch(this);
+
+	entries_.push_back(std::move(entry));
+
+	return entries_.size() - 1;
+}
+
+inline void QueueSelector::remove(const std::size_t index)
+{
+	if(index >= entries_.size() || !entries_[index].watch)
+	{
+		throw std::runtime_error(ERR_QUEUE_SELECTOR_BAD_INDEX);
+	}
+
+	entries_[index].watch(nullptr);
+	entries_[index] = Entry();
+}
+
+inline std::vector<std::size_t> QueueSelector::poll()
+{
+	std::vector<std::size_t> ready;
+
+	const auto count = entries_.size();
+
+	if(count == 0) return ready;
+
+	const auto first = fairness_ == Fairness::RoundRobin ? next_ % count : 0;
+
+	for(std::size_t i = 0; i < count; i++)
+	{
+		const auto index = (first + i) % count;
+
+		if(entries_[index].readable && entries_[index].readable()) ready.push_back(index);
+	}
+
+	if(!ready.empty()) next_ = ready.front() + 1;
+
+	return ready;
+}
+
+//
+// the generation is read before looking at the queues. a push that lands
+// after its queue was looked at bumps it, so we look again instead of
+// sleeping through it
+//
+inline std::vector<std::size_t> QueueSelector::wait_until(const Deadline deadline)
+{
+	for(;;)
+	{
+		std::uint64_t generation;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			generation = generation_;
+		}
+
+		auto ready = poll();
+
+		if(!ready.empty()) return ready;
+
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		waiting_ = true;
+
+		while(generation_ == generation)
+		{
+			if(deadline == Deadline::max())
+			{
+				cond_.wait(lock);
+			}
+			else if(cond_.wait_until(lock, deadline) == std::cv_status::timeout && generation_ == generation)
+			{
+				waiting_ = false;
+
+				return ready;
+			}
+		}
+
+		waiting_ = false;
+	}
+}
+
+inline void QueueSelector::queue_ready()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	generation_++;
+
+	if(waiting_) cond_.notify_one();
+}
+
+} // namespace rtw
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include <rtw/meta.hpp>
+
+namespace rtw
+{
+
+//
+// a FIFO in one power-of-two sized block that doubles when it fills up and
+// never shrinks
+//
+// unlike std::deque it doesn't allocate and free chunks as items go through
+// it, so once it's big enough a queue built on it stops touching the heap
+//
+template <class T>
+class RingBuffer : private meta::NoCopy
+{
+
+public:
+
+	RingBuffer(std::size_t capacity = 16);
+	~RingBuffer();
+
+	template <class... Args>
+	void emplace_back(Args &&... args);
+
+	void push_back(T && value) { emplace_back(std::move(value)); }
+
+	T & front() { return slot(head_); }
+	void pop_front();
+
+	void reserve(std::size_t capacity);
+
+	bool empty() const { return size_ == 0; }
+	std::size_t size() const { return size_; }
+	std::size_t capacity() const { return mask_ + 1; }
+
+private:
+
+	T & slot(std::size_t i) { return *reinterpret_cast<T *>(&slots_[i & mask_]); }
+
+	using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+	std::unique_ptr<Slot[]> slots_;
+	std::size_t             mask_;
+	std::size_t             head_;
+	std::size_t             size_;
+
+};
+
+template <class T> RingBuffer<T>::RingBuffer(std::size_t capacity) :
+	mask_(0),
+	head_(0),
+	size_(0)
+{
+	std::size_t pow2 = 1;
+
+	while(pow2 < capacity) pow2 <<= 1;
+
+	slots_.reset(new Slot[pow2]);
+
+	mask_ = pow2 - 1;
+}
+
+template <class T> RingBuffer<T>::~RingBuffer()
+{
+	while(!empty()) pop_front();
+}
+
+template <class T>
+template <class... Args>
+void RingBuffer<T>::emplace_back(Args &&... args)
+{
+	if(size_ == capacity())
+	{
+		reserve(capacity() * 2);
+	}
+
+	new (&slots_[(head_ + size_) & mask_]) T(std::forward<Args>(args)...);
+
+	size_++;
+}
+
+template <class T> void RingBuffer<T>::pop_front()
+{
+	slot(head_).~T();
+
+	head_ = (head_ + 1) & mask_;
+	size_--;
+}
+
+template <class T> void RingBuffer<T>::reserve(std::size_t capacity)
+{
+	if(capacity <= this->capacity()) return;
+
+	std::size_t pow2 = this->capacity();
+
+	while(pow2 < capacity) pow2 <<= 1;
+
+	std::unique_ptr<Slot[]> slots(new Slot[pow2]);
+
+	for(std::size_t i = 0; i < size_; i++)
+	{
+		auto & item = slot(head_ + i);
+
+		new (&slots[i]) T(std::move(item));
+
+		item.~T();
+	}
+
+	slots_ = std::move(slots);
+	mask_  = pow2 - 1;
+	head_  = 0;
+}
+
+} // namespace rtw
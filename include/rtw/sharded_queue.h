@@ -0,0 +1,294 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include <rtw/meta.hpp>
+#include <rtw/parking_lot.h>
+#include <rtw/sync_queue.h>
+
+namespace rtw
+{
+
+//
+// a queue made of [shards] SyncQueues, so producers and consumers spread
+// over several locks and cache lines instead of all fighting over one
+//
+// each producer thread sticks to one shard. consumers look at two shards at
+// random and take from the fuller one (the "power of two choices", which
+// keeps the shards about level without anybody looking at all of them), and
+// only go round the rest if both are empty
+//
+// the price is ordering: each shard is FIFO, so values from one producer
+// thread come out in the order it pushed them, but there's no order between
+// shards. fine for independent work items, not for anything that needs a
+// global order
+//
+// it has SyncQueue's push/pop/kill (less the bounded and Wait modes), so it
+// can stand in for one. waiting consumers spin, then park (see
+// detail::Waiters)
+//
+template <class T>
+class ShardedQueue : private meta::NoCopy
+{
+
+public:
+
+	using Result = SyncQueueResult<T>;
+
+	//
+	// 0 shards means one per cpu
+	//
+	explicit ShardedQueue(std::size_t shards = 0);
+
+	void kill();
+	void push(T && value);
+
+	template <class... Args>
+	void emplace(Args &&... args);
+
+	//
+	// the whole range goes in the calling thread's shard, under one lock
+	//
+	template <class Iterator>
+	void push_range(Iterator first, Iterator last);
+
+	Result pop();
+	Result try_pop();
+
+	//
+	// only a snapshot, and cheap: it doesn't take any locks
+	//
+	std::size_t size() const;
+
+	std::size_t shards() const { return num_shards_; }
+
+	//
+	// the shards' stats added up. high_water is the sum of the shards' high
+	// water marks, so it can be more than was ever in the queue at once
+	//
+	SyncQueueStats stats() const;
+
+private:
+
+	struct Shard
+	{
+		SyncQueue<T> queue;
+
+		//
+		// roughly queue.size(), without taking the lock. it's bumped after
+		// a push and dropped after a pop, so it can dip below zero for a
+		// moment
+		//
+		std::atomic<std::ptrdiff_t> size;
+
+		char pad[detail::CACHE_LINE];
+
+		Shard() : size(0) {}
+	};
+
+	Shard & home_shard() { return shards_[thread_index() % num_shards_]; }
+
+	bool try_pop_into(T & value);
+	bool try_pop_from(Shard & shard, T & value);
+
+	static std::size_t thread_index();
+	static std::uint32_t random();
+
+	std::unique_ptr<Shard[]> shards_;
+	std::size_t              num_shards_;
+	std::atomic<bool>        dying_;
+	detail::Waiters          waiters_;
+
+};
+
+template <class T> ShardedQueue<T>::ShardedQueue(std::size_t shards) :
+	num_shards_(0),
+	dying_(false)
+{
+	if(shards == 0) shards = std::thread::hardware_concurrency();
+	if(shards == 0) shards = 1;
+
+	shards_.reset(new Shard[shards]);
+
+	num_shards_ = shards;
+}
+
+//
+// wakes every consumer waiting in pop(), which returns a 'dead' result from
+// then on
+//
+template <class T> void ShardedQueue<T>::kill()
+{
+	dying_.store(true, std::memory_order_seq_cst);
+
+	for(std::size_t i = 0; i < num_shards_; i++) shards_[i].queue.kill();
+
+	waiters_.notify_all();
+}
+
+template <class T> void ShardedQueue<T>::push(T && value)
+{
+	emplace(std::move(value));
+}
+
+template <class T>
+template <class... Args>
+void ShardedQueue<T>::emplace(Args &&... args)
+{
+	auto & shard = home_shard();
+
+	shard.queue.emplace(std::forward<Args>(args)...);
+	shard.size.fetch_add(1, std::memory_order_relaxed);
+
+	waiters_.notify();
+}
+
+template <class T>
+template <class Iterator>
+void ShardedQueue<T>::push_range(Iterator first, Iterator last)
+{
+	auto & shard = home_shard();
+
+	const auto count = shard.queue.push_range(first, last);
+
+	if(count == 0) return;
+
+	shard.size.fetch_add(std::ptrdiff_t(count), std::memory_order_relaxed);
+
+	waiters_.notify();
+}
+
+template <class T> auto ShardedQueue<T>::pop() -> Result
+{
+	T value;
+
+	auto popped = false;
+
+	waiters_.wait([this, &value, &popped]()
+	{
+		if(dying_.load(std::memory_order_acquire)) return true;
+
+		popped = try_pop_into(value);
+
+		return popped;
+	});
+
+	if(!popped) return Result();
+
+	return Result(std::move(value));
+}
+
+template <class T> auto ShardedQueue<T>::try_pop() -> Result
+{
+	T value;
+
+	if(dying_.load(std::memory_order_acquire) || !try_pop_into(value)) return Result();
+
+	return Result(std::move(value));
+}
+
+template <class T> std::size_t ShardedQueue<T>::size() const
+{
+	std::ptrdiff_t total = 0;
+
+	for(std::size_t i = 0; i < num_shards_; i++) total += shards_[i].size.load(std::memory_order_relaxed);
+
+	return total > 0 ? std::size_t(total) : 0;
+}
+
+template <class T> SyncQueueStats ShardedQueue<T>::stats() const
+{
+	SyncQueueStats total = {};
+
+	for(std::size_t i = 0; i < num_shards_; i++)
+	{
+		const auto stats = shards_[i].queue.stats();
+
+		total.size       += stats.size;
+		total.high_water += stats.high_water;
+		total.pushes     += stats.pushes;
+		total.pops       += stats.pops;
+		total.contended  += stats.contended;
+	}
+
+	return total;
+}
+
+//
+// the fuller of two random shards first, then the rest in order. shards that
+// look empty are skipped, which is safe for pop(): a producer bumps the size
+// before it notifies, so a consumer that misses a value here gets woken
+//
+template <class T> bool ShardedQueue<T>::try_pop_into(T & value)
+{
+	std::size_t first = 0;
+
+	if(num_shards_ > 1)
+	{
+		const auto a = random() % num_shards_;
+		const auto b = random() % num_shards_;
+
+		const auto size_a = shards_[a].size.load(std::memory_order_relaxed);
+		const auto size_b = shards_[b].size.load(std::memory_order_relaxed);
+
+		first = size_a >= size_b ? a : b;
+	}
+
+	for(std::size_t i = 0; i < num_shards_; i++)
+	{
+		auto & shard = shards_[(first + i) % num_shards_];
+
+		if(shard.size.load(std::memory_order_relaxed) > 0 && try_pop_from(shard, value)) return true;
+	}
+
+	return false;
+}
+
+template <class T> bool ShardedQueue<T>::try_pop_from(Shard & shard, T & value)
+{
+	auto result = shard.queue.try_pop();
+
+	if(!result) return false;
+
+	shard.size.fetch_sub(1, std::memory_order_relaxed);
+
+	value = std::move(result.get());
+
+	return true;
+}
+
+//
+// handed out in the order threads first push, so the first [shards]
+// producers all get a shard to themselves
+//
+template <class T> std::size_t ShardedQueue<T>::thread_index()
+{
+	static std::atomic<std::size_t> next(0);
+
+	static thread_local const std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+
+	return index;
+}
+
+//
+// xorshift, one per thread. it only has to spread consumers around
+//
+template <class T> std::uint32_t ShardedQueue<T>::random()
+{
+	static thread_local std::uint32_t state =
+		std::uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	return state;
+}
+
+} // namespace rtw
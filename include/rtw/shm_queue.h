@@ -0,0 +1,652 @@
+#pragma once
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <rtw/error.hpp>
+#include <rtw/futex.hpp>
+#include <rtw/meta.hpp>
+#include <rtw/parking_lot.h>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+static_assert(
+	ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+	"a ShmQueue needs lock-free atomics to share them between processes");
+
+//
+// what's at the start of a ShmQueue's segment. every process that maps it has
+// to make sense of it, so there are no pointers in here, only offsets
+//
+struct ShmQueueHeader
+{
+	//
+	// set last when the queue is created, so nobody opens it half made
+	//
+	std::atomic<std::uint64_t> magic;
+	std::uint64_t              capacity;
+
+	//
+	// producers take push_mutex from begin_push to end_push, and push_end is
+	// where the record they're writing ends. the same for consumers
+	//
+	char            pad0[CACHE_LINE];
+	pthread_mutex_t push_mutex;
+	std::uint64_t   push_end;
+
+	char            pad1[CACHE_LINE];
+	pthread_mutex_t pop_mutex;
+	std::uint64_t   pop_end;
+
+	//
+	// byte positions that only ever go up. the ring offset is position %
+	// capacity
+	//
+	char                       pad2[CACHE_LINE];
+	std::atomic<std::uint64_t> tail;
+	char                       pad3[CACHE_LINE];
+	std::atomic<std::uint64_t> head;
+	char                       pad4[CACHE_LINE];
+
+	//
+	// the futex words the one waiting consumer (or producer) sleeps on, and
+	// whether there is one, so the other side can skip the syscall
+	//
+	std::atomic<std::uint32_t> pushed;
+	std::atomic<std::uint32_t> popped;
+	std::atomic<std::uint32_t> consumers_waiting;
+	std::atomic<std::uint32_t> producers_waiting;
+	std::atomic<std::uint32_t> killed;
+	std::atomic<std::uint64_t> recoveries;
+};
+
+//
+// every record starts on an 8 byte boundary with one of these
+//
+struct ShmRecord
+{
+	std::uint32_t size;
+	std::uint32_t flags;
+};
+
+} // namespace detail
+
+//
+// a bounded queue of byte records in a POSIX shared memory segment, so
+// processes on the same host can hand records to each other without a
+// socket, and without copying them if they don't want to
+//
+// one process creates it and any number open it by name. then any of them
+// can push and pop, from any number of threads:
+//``````````````````````````````````````````````````````````````````````````````
+//	// the producer process
+//	auto queue = rtw::ShmQueue::create("/ticks", 1 << 20);
+//
+//	auto tick = static_cast<Tick *>(queue.begin_push(sizeof(Tick)));
+//
+//	fill(*tick);
+//
+//	queue.end_push();
+//
+//	// a consumer process
+//	auto queue = rtw::ShmQueue::open("/ticks");
+//
+//	std::size_t size;
+//
+//	while(auto record = queue.begin_pop(&size))
+//	{
+//		handle(static_cast<const Tick *>(record), size);
+//
+//		queue.end_pop();
+//	}
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+// records can be any size up to half the capacity, and each one is in one
+// piece in the ring so it can be written and read in place. push and pop
+// copy for when that's simpler, and push(value)/pop(value) handle fixed size
+// trivially copyable records
+//
+// producers take turns under one lock and consumers under another, so a
+// producer only waits for a consumer when the ring's full (and the other way
+// round). a waiting process sleeps on a futex in the segment, and the other
+// side only makes the syscall to wake it if something is actually waiting
+//
+// like SyncQueue, once the queue has been killed (by any process) everybody
+// waiting is woken and pushes and pops fail
+//
+// if a process dies part way through, the locks are robust, so the next
+// process to take one carries on (see recoveries()). a record a dead producer
+// was writing is dropped, and one a dead consumer was reading gets read again
+// by the next consumer, so delivery is at least once. without robust mutexes
+// (macOS) a dead peer holding a lock needs the queue killed and recreated
+//
+// the segment stays around until remove() is called, even when nobody has it
+// open
+//
+class ShmQueue : private meta::NoCopy
+{
+
+public:
+
+	//
+	// the capacity (in bytes) gets rounded up to a power of two. throws if
+	// there's already a segment called [name]
+	//
+	static ShmQueue create(const std::string & name, std::size_t capacity);
+	static ShmQueue open(const std::string & name);
+	static void remove(const std::string & name);
+
+	ShmQueue(ShmQueue && rhs);
+	~ShmQueue();
+
+	//
+	// waits for room for a [size] byte record and returns where to write
+	// it, holding the push lock until end_push publishes it (or
+	// cancel_push drops it). nullptr once the queue has been killed
+	//
+	void * begin_push(std::size_t size);
+	void * try_begin_push(std::size_t size);
+	void end_push();
+	void cancel_push();
+
+	//
+	// waits for a record and returns it (and its size), holding the pop lock
+	// until end_pop takes it off the queue. nullptr once the queue has been
+	// killed
+	//
+	const void * begin_pop(std::size_t * size);
+	const void * try_begin_pop(std::size_t * size);
+	void end_pop();
+
+	//
+	// copying versions. false once the queue has been killed (or for the
+	// try_ ones, if they'd have to wait)
+	//
+	bool push(const void * data, std::size_t size);
+	bool try_push(const void * data, std::size_t size);
+	bool pop(std::vector<char> & record);
+	bool try_pop(std::vector<char> & record);
+
+	template <class T, class = typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+	bool push(const T & value) { return push(&value, sizeof(T)); }
+
+	template <class T, class = typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+	bool pop(T & value);
+
+	void kill();
+	bool killed() const { return header().killed.load(std::memory_order_acquire) != 0; }
+
+	std::size_t capacity() const { return std::size_t(header().capacity); }
+
+	//
+	// bytes in use, records and padding. only a snapshot
+	//
+	std::size_t size() const;
+
+	//
+	// how many times a process took a lock that a dead process was holding
+	//
+	std::size_t recoveries() const { return std::size_t(header().recoveries.load(std::memory_order_relaxed)); }
+
+private:
+
+	ShmQueue(void * base, std::size_t mapped);
+
+	detail::ShmQueueHeader & header() const { return *static_cast<detail::ShmQueueHeader *>(base_); }
+	char * ring() const { return static_cast<char *>(base_) + RING_OFFSET; }
+
+	void * start_push(std::size_t size, bool wait);
+	const void * start_pop(std::size_t * size, bool wait);
+
+	void lock(pthread_mutex_t & mutex);
+	void wait(std::atomic<std::uint32_t> & signal, std::atomic<std::uint32_t> & waiting, const std::atomic<std::uint64_t> & index, std::uint64_t seen);
+	void wake(std::atomic<std::uint32_t> & signal, const std::atomic<std::uint32_t> & waiting);
+
+	static std::uint64_t record_bytes(std::size_t size) { return (sizeof(detail::ShmRecord) + size + 7) & ~std::uint64_t(7); }
+
+	static constexpr std::uint64_t MAGIC       = 0x71626d68735f7772;
+	static constexpr std::uint32_t WRAP        = 1;
+	static constexpr std::size_t   RING_OFFSET = (sizeof(detail::ShmQueueHeader) + detail::CACHE_LINE - 1) & ~(detail::CACHE_LINE - 1);
+
+	void *      base_;
+	std::size_t mapped_;
+
+	static constexpr auto ERR_SHM_QUEUE_NOT_A_QUEUE =
+		"a bad programmer tried to open a shared memory segment that isn't a "
+		"(finished) queue"
+		;
+
+	static constexpr auto ERR_SHM_QUEUE_RECORD_TOO_BIG =
+		"a bad programmer tried to push a record bigger than half a shared "
+		"memory queue"
+		;
+
+};
+
+inline ShmQueue::ShmQueue(void * const base, const std::size_t mapped) :
+	base_(base),
+	mapped_(mapped)
+{
+}
+
+inline ShmQueue::ShmQueue(ShmQueue && rhs) :
+	base_(rhs.base_),
+	mapped_(rhs.mapped_)
+{
+	rhs.base_ = nullptr;
+}
+
+inline ShmQueue::~ShmQueue()
+{
+	if(base_) munmap(base_, mapped_);
+}
+
+inline ShmQueue ShmQueue::create(const std::string & name, std::size_t capacity)
+{
+	std::size_t pow2 = 4096;
+
+	while(pow2 < capacity) pow2 <<= 1;
+
+	const auto mapped = RING_OFFSET + pow2;
+	const auto fd     = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+	if(fd < 0)
+	{
+		throw std::runtime_error(error::failed_to_do_x_with_y("create shared memory segment", name) + " (" + std::strerror(errno) + ")");
+	}
+
+	const auto base = ftruncate(fd, off_t(mapped)) == 0 ?
+		mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) :
+		MAP_FAILED;
+
+	const auto why = errno;
+
+	close(fd);
+
+	if(base == MAP_FAILED)
+	{
+		shm_unlink(name.c_str());
+
+		throw std::runtime_error(error::failed_to_do_x_with_y("map shared memory segment", name) + " (" + std::strerror(why) + ")");
+	}
+
+	//
+	// the segment comes zeroed, which is a fine start for everything but the
+	// mutexes
+	//
+	const auto header = new (base) detail::ShmQueueHeader;
+
+	header->capacity = pow2;
+
+	pthread_mutexattr_t attributes;
+
+	pthread_mutexattr_init(&attributes);
+	pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+
+#if defined(__linux__)
+	pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+#endif
+
+	pthread_mutex_init(&header->push_mutex, &attributes);
+	pthread_mutex_init(&header->pop_mutex, &attributes);
+
+	pthread_mutexattr_destroy(&attributes);
+
+	header->magic.store(MAGIC, std::memory_order_release);
+
+	return ShmQueue(base, mapped);
+}
+
+inline ShmQueue ShmQueue::open(const std::string & name)
+{
+	const auto fd = shm_open(name.c_str(), O_RDWR, 0600);
+
+	if(fd < 0)
+	{
+		throw std::runtime_error(error::failed_to_do_x_with_y("open shared memory segment", name) + " (" + std::strerror(errno) + ")");
+	}
+
+	struct stat info;
+
+	const auto base = fstat(fd, &info) == 0 && std::size_t(info.st_size) > RING_OFFSET ?
+		mmap(nullptr, std::size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) :
+		MAP_FAILED;
+
+	close(fd);
+
+	if(base == MAP_FAILED)
+	{
+		throw std::runtime_error(ERR_SHM_QUEUE_NOT_A_QUEUE);
+	}
+
+	ShmQueue queue(base, std::size_t(info.st_size));
+
+	const auto & header = queue.header();
+
+	if(header.magic.load(std::memory_order_acquire) != MAGIC || RING_OFFSET + header.capacity != queue.mapped_)
+	{
+		throw std::runtime_error(ERR_SHM_QUEUE_NOT_A_QUEUE);
+	}
+
+	return queue;
+}
+
+inline void ShmQueue::remove(const std::string & name)
+{
+	shm_unlink(name.c_str());
+}
+
+inline void * ShmQueue::begin_push(const std::size_t size) { return start_push(size, true); }
+inline void * ShmQueue::try_begin_push(const std::size_t size) { return start_push(size, false); }
+
+inline const void * ShmQueue::begin_pop(std::size_t * const size) { return start_pop(size, true); }
+inline const void * ShmQueue::try_begin_pop(std::size_t * const size) { return start_pop(size, false); }
+
+//
+// a record that won't fit before the end of the ring gets a WRAP record in
+// front of it to skip to the start. neither is visible to consumers until
+// end_push moves the tail past them
+//
+inline void * ShmQueue::start_push(const std::size_t size, const bool should_wait)
+{
+	auto & h = header();
+
+	const auto needed = record_bytes(size);
+
+	if(needed > h.capacity / 2)
+	{
+		throw std::runtime_error(ERR_SHM_QUEUE_RECORD_TOO_BIG);
+	}
+
+	lock(h.push_mutex);
+
+	for(;;)
+	{
+		if(killed()) break;
+
+		const auto tail       = h.tail.load(std::memory_order_relaxed);
+		const auto head       = h.head.load(std::memory_order_acquire);
+		const auto offset     = tail & (h.capacity - 1);
+		const auto contiguous = h.capacity - offset;
+		const auto total      = needed <= contiguous ? needed : contiguous + needed;
+
+		if(h.capacity - (tail - head) >= total)
+		{
+			auto record = reinterpret_cast<detail::ShmRecord *>(ring() + offset);
+
+			if(needed > contiguous)
+			{
+				record->size  = 0;
+				record->flags = WRAP;
+
+				record = reinterpret_cast<detail::ShmRecord *>(ring());
+			}
+
+			record->size  = std::uint32_t(size);
+			record->flags = 0;
+
+			h.push_end = tail + total;
+
+			return record + 1;
+		}
+
+		if(!should_wait) break;
+
+		wait(h.popped, h.producers_waiting, h.head, head);
+	}
+
+	pthread_mutex_unlock(&h.push_mutex);
+
+	return nullptr;
+}
+
+inline void ShmQueue::end_push()
+{
+	auto & h = header();
+
+	h.tail.store(h.push_end, std::memory_order_seq_cst);
+
+	wake(h.pushed, h.consumers_waiting);
+
+	pthread_mutex_unlock(&h.push_mutex);
+}
+
+inline void ShmQueue::cancel_push()
+{
+	pthread_mutex_unlock(&header().push_mutex);
+}
+
+inline const void * ShmQueue::start_pop(std::size_t * const size, const bool should_wait)
+{
+	auto & h = header();
+
+	lock(h.pop_mutex);
+
+	for(;;)
+	{
+		if(killed()) break;
+
+		auto       head = h.head.load(std::memory_order_relaxed);
+		const auto tail = h.tail.load(std::memory_order_acquire);
+
+		if(head != tail)
+		{
+			auto record = reinterpret_cast<const detail::ShmRecord *>(ring() + (head & (h.capacity - 1)));
+
+			if(record->flags & WRAP)
+			{
+				head  += h.capacity - (head & (h.capacity - 1));
+				record = reinterpret_cast<const detail::ShmRecord *>(ring());
+			}
+
+			*size = record->size;
+
+			h.pop_end = head + record_bytes(record->size);
+
+			return record + 1;
+		}
+
+		if(!should_wait) break;
+
+		wait(h.pushed, h.consumers_waiting, h.tail, tail);
+	}
+
+	pthread_mutex_unlock(&h.pop_mutex);
+
+	return nullptr;
+}
+
+inline void ShmQueue::end_pop()
+{
+	auto & h = header();
+
+	h.head.store(h.pop_end, std::memory_order_seq_cst);
+
+	wake(h.popped, h.producers_waiting);
+
+	pthread_mutex_unlock(&h.pop_mutex);
+}
+
+inline bool ShmQueue::push(const void * const data, const std::size_t size)
+{
+	const auto record = begin_push(size);
+
+	if(!record) return false;
+
+	std::memcpy(record, data, size);
+
+	end_push();
+
+	return true;
+}
+
+inline bool ShmQueue::try_push(const void * const data, const std::size_t size)
+{
+	const auto record = try_begin_push(size);
+
+	if(!record) return false;
+
+	std::memcpy(record, data, size);
+
+	end_push();
+
+	return true;
+}
+
+inline bool ShmQueue::pop(std::vector<char> & record)
+{
+	std::size_t size;
+
+	const auto data = static_cast<const char *>(begin_pop(&size));
+
+	if(!data) return false;
+
+	record.assign(data, data + size);
+
+	end_pop();
+
+	return true;
+}
+
+inline bool ShmQueue::try_pop(std::vector<char> & record)
+{
+	std::size_t size;
+
+	const auto data = static_cast<const char *>(try_begin_pop(&size));
+
+	if(!data) return false;
+
+	record.assign(data, data + size);
+
+	end_pop();
+
+	return true;
+}
+
+//
+// a record of the wrong size is left where it is and this throws
+//
+template <class T, class>
+bool ShmQueue::pop(T & value)
+{
+	std::size_t size;
+
+	const auto data = begin_pop(&size);
+
+	if(!data) return false;
+
+	if(size != sizeof(T))
+	{
+		pthread_mutex_unlock(&header().pop_mutex);
+
+		throw std::runtime_error(error::failed_to_do_x("pop a shared memory record", "it's the wrong size"));
+	}
+
+	std::memcpy(&value, data, sizeof(T));
+
+	end_pop();
+
+	return true;
+}
+
+inline void ShmQueue::kill()
+{
+	auto & h = header();
+
+	h.killed.store(1, std::memory_order_seq_cst);
+
+	h.pushed.fetch_add(1, std::memory_order_seq_cst);
+	h.popped.fetch_add(1, std::memory_order_seq_cst);
+
+	detail::futex_wake_shared(h.pushed);
+	detail::futex_wake_shared(h.popped);
+}
+
+inline std::size_t ShmQueue::size() const
+{
+	const auto & h = header();
+
+	const auto head = h.head.load(std::memory_order_relaxed);
+	const auto tail = h.tail.load(std::memory_order_relaxed);
+
+	return tail > head ? std::size_t(tail - head) : 0;
+}
+
+//
+// a process that died holding the lock left the indices alone unless it got
+// as far as publishing, so they're still consistent and we can carry on
+//
+inline void ShmQueue::lock(pthread_mutex_t & mutex)
+{
+	const auto result = pthread_mutex_lock(&mutex);
+
+#if defined(__linux__)
+	if(result == EOWNERDEAD)
+	{
+		pthread_mutex_consistent(&mutex);
+
+		header().recoveries.fetch_add(1, std::memory_order_relaxed);
+
+		return;
+	}
+#endif
+
+	if(result != 0)
+	{
+		throw std::runtime_error(error::failed_to_do_x("lock a shared memory queue", std::strerror(result)));
+	}
+}
+
+//
+// the waiting count is bumped before the last look at [index], and the other
+// side moves [index] before it looks at the count, so either we see it move
+// or it wakes us. called with the lock for our side held, so there's only
+// ever one waiter per side
+//
+// it only sleeps for a while before looking again anyway, in case the process
+// that should have woken it died first
+//
+inline void ShmQueue::wait(std::atomic<std::uint32_t> & signal, std::atomic<std::uint32_t> & waiting, const std::atomic<std::uint64_t> & index, const std::uint64_t seen)
+{
+	waiting.fetch_add(1, std::memory_order_seq_cst);
+
+	const auto expected = signal.load(std::memory_order_seq_cst);
+
+	if(index.load(std::memory_order_seq_cst) == seen && !killed())
+	{
+		detail::futex_wait_shared(signal, expected, std::chrono::milliseconds(100));
+	}
+
+	waiting.fetch_sub(1, std::memory_order_relaxed);
+}
+
+inline void ShmQueue::wake(std::atomic<std::uint32_t> & signal, const std::atomic<std::uint32_t> & waiting)
+{
+	if(waiting.load(std::memory_order_seq_cst) == 0) return;
+
+	signal.fetch_add(1, std::memory_order_seq_cst);
+
+	detail::futex_wake_shared(signal);
+}
+
+} // namespace rtw
@@ -0,0 +1,631 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <rtw/error.hpp>
+#include <rtw/meta.hpp>
+#include <rtw/ring_buffer.h>
+#include <rtw/sync_queue.h>
+
+namespace rtw
+{
+
+//
+// turns values into bytes and back for SpillingQueue. this one handles
+// trivially copyable types and std::string. for anything else, specialize it
+// or hand SpillingQueue a class with the same two functions
+//
+template <class T>
+struct Serializer
+{
+	static_assert(
+		std::is_trivially_copyable<T>::value,
+		"specialize rtw::Serializer (or give SpillingQueue your own) for types that can't just be copied");
+
+	static void write(const T & value, std::string & out)
+	{
+		out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+
+	static T read(const char * data, std::size_t)
+	{
+		T value;
+
+		std::memcpy(&value, data, sizeof(T));
+
+		return value;
+	}
+};
+
+template <>
+struct Serializer<std::string>
+{
+	static void write(const std::string & value, std::string & out) { out += value; }
+	static std::string read(const char * data, std::size_t size) { return std::string(data, size); }
+};
+
+//
+// how a SpillingQueue spills
+//
+struct SpillOptions
+{
+	explicit SpillOptions(std::string directory, std::size_t window = 4096) :
+		directory(std::move(directory)),
+		window(window),
+		segment_size(std::size_t(64) << 20),
+		sync_every(0),
+		sync_interval(std::chrono::milliseconds::zero())
+	{
+	}
+
+	//
+	// where the segment files go. they're unlinked as soon as they're
+	// created, so nothing is left behind whatever happens to the process
+	//
+	std::string directory;
+
+	//
+	// how many values are kept in memory
+	//
+	std::size_t window;
+
+	//
+	// segments are mapped this big (or as big as one value needs)
+	//
+	std::size_t segment_size;
+
+	//
+	// spilled values are written to a shared mapping, so the kernel writes
+	// them back whenever it likes. to keep the amount of dirty memory down,
+	// msync what's been written every [sync_every] values and/or every
+	// [sync_interval]. zero means don't bother
+	//
+	// the msync is MS_SYNC (MS_ASYNC doesn't do anything on linux), but it's
+	// done by the pushing thread after it's let go of the queue's lock, so
+	// it's only ever that push that waits for the disk, never a consumer
+	//
+	std::size_t               sync_every;
+	std::chrono::milliseconds sync_interval;
+};
+
+namespace detail
+{
+
+//
+// one file of a SpillingQueue's log, mapped whole. records are a 32 bit size
+// followed by the bytes
+//
+class SpillSegment : private meta::NoCopy
+{
+
+public:
+
+	SpillSegment(const std::string & directory, std::size_t size);
+	~SpillSegment();
+
+	bool fits(std::size_t bytes) const { return write_pos + RECORD_HEADER + bytes <= size_; }
+
+	void append(const std::string & bytes);
+
+	//
+	// the next record, and moves read_pos past it
+	//
+	const char * next(std::size_t * bytes);
+
+	//
+	// msyncs [from, to). doesn't touch the positions, so it can be called
+	// without the queue's lock as long as the segment is kept alive
+	//
+	void sync(std::size_t from, std::size_t to) const;
+
+	static constexpr std::size_t RECORD_HEADER = sizeof(std::uint32_t);
+
+	//
+	// the most a record's size can say
+	//
+	static constexpr std::size_t MAX_RECORD = std::uint32_t(-1);
+
+	std::size_t write_pos;
+	std::size_t read_pos;
+	std::size_t synced_pos;
+
+private:
+
+	int         fd_;
+	char *      data_;
+	std::size_t size_;
+
+};
+
+inline SpillSegment::SpillSegment(const std::string & directory, const std::size_t size) :
+	write_pos(0),
+	read_pos(0),
+	synced_pos(0),
+	fd_(-1),
+	data_(nullptr),
+	size_(size)
+{
+	std::string path = directory + "/rtw-spill-XXXXXX";
+
+	fd_ = mkstemp(&path[0]);
+
+	if(fd_ < 0)
+	{
+		throw std::runtime_error(error::failed_to_do_x_with_y("create a spill segment in", directory) + " (" + std::strerror(errno) + ")");
+	}
+
+	unlink(path.c_str());
+
+	//
+	// the blocks have to be there before we write through the mapping. a
+	// sparse file on a full disk turns the memcpy in append() into a SIGBUS,
+	// and a full disk is exactly when we're likely to be spilling
+	//
+	const auto reserved = posix_fallocate(fd_, 0, off_t(size));
+
+	if(reserved != 0)
+	{
+		close(fd_);
+
+		throw std::runtime_error(error::failed_to_do_x_with_y("reserve space for a spill segment in", directory) + " (" + std::strerror(reserved) + ")");
+	}
+
+	const auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+
+	if(data == MAP_FAILED)
+	{
+		const auto why = errno;
+
+		close(fd_);
+
+		throw std::runtime_error(error::failed_to_do_x_with_y("map a spill segment in", directory) + " (" + std::strerror(why) + ")");
+	}
+
+	data_ = static_cast<char *>(data);
+
+#if defined(MADV_SEQUENTIAL)
+	madvise(data_, size_, MADV_SEQUENTIAL);
+#endif
+}
+
+inline SpillSegment::~SpillSegment()
+{
+	munmap(data_, size_);
+	close(fd_);
+}
+
+inline void SpillSegment::append(const std::string & bytes)
+{
+	const auto size = std::uint32_t(bytes.size());
+
+	std::memcpy(data_ + write_pos, &size, RECORD_HEADER);
+	std::memcpy(data_ + write_pos + RECORD_HEADER, bytes.data(), bytes.size());
+
+	write_pos += RECORD_HEADER + bytes.size();
+}
+
+inline const char * SpillSegment::next(std::size_t * const bytes)
+{
+	std::uint32_t size;
+
+	std::memcpy(&size, data_ + read_pos, RECORD_HEADER);
+
+	const auto record = data_ + read_pos + RECORD_HEADER;
+
+	read_pos += RECORD_HEADER + size;
+	*bytes    = size;
+
+	return record;
+}
+
+//
+// msync wants a page aligned start
+//
+inline void SpillSegment::sync(const std::size_t from, const std::size_t to) const
+{
+	if(from >= to) return;
+
+	const auto page  = std::size_t(sysconf(_SC_PAGESIZE));
+	const auto start = from / page * page;
+
+	msync(data_ + start, to - start, MS_SYNC);
+}
+
+} // namespace detail
+
+//
+// a SyncQueue for backlogs that don't fit in memory: the first
+// SpillOptions::window values are kept in memory like any other queue, and
+// once that's full the rest go to an append-only log of memory mapped files
+// on disk, to be read back in order as consumers catch up
+//
+// once anything has spilled, new values go to the end of the log too (even if
+// the window has room by then), so values still come out in the order they
+// were pushed. a pop that makes room in the window reads the next values back
+// in from the log
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::SpillOptions options("/var/spool/ingest", 100000);
+//
+//	options.sync_every = 1024;
+//
+//	rtw::SpillingQueue<std::string> events(options);
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+// writing to the log is a serialize and a memcpy into the mapping, so
+// pushing stays cheap and the disk sees nothing but sequential writes.
+// segments are dropped as soon as they've been read back
+//
+// segments have their disk space reserved up front, so a full disk makes
+// push throw (leaving the value with the caller) rather than crash the
+// process
+//
+// the log is only there to take the load off memory. it doesn't survive the
+// process, so don't use it for anything that has to
+//
+template <class T, class Serializer = rtw::Serializer<T>>
+class SpillingQueue : private meta::NoCopy
+{
+
+public:
+
+	using Result = SyncQueueResult<T>;
+
+	explicit SpillingQueue(const SpillOptions & options);
+
+	void kill();
+	void push(T && value);
+	void push(const T & value);
+
+	template <class... Args>
+	void emplace(Args &&... args);
+
+	Result pop();
+	Result try_pop();
+
+	template <class Rep, class Period>
+	Result pop_for(const std::chrono::duration<Rep, Period> & timeout);
+
+	std::size_t size() const;
+
+	//
+	// how many of size() are on disk, and how many bytes they take
+	//
+	std::size_t spilled() const;
+	std::size_t spilled_bytes() const;
+
+private:
+
+	using Clock      = std::chrono::steady_clock;
+	using Segment    = detail::SpillSegment;
+	using SegmentPtr = std::shared_ptr<Segment>;
+
+	//
+	// what a push has to msync once it's let go of the lock. the shared_ptr
+	// keeps the segment mapped even if a consumer drops it meanwhile. at
+	// most two: the end of a segment it moved off, and the one it's on
+	//
+	struct SyncRange
+	{
+		SegmentPtr  segment;
+		std::size_t from;
+		std::size_t to;
+	};
+
+	struct Syncs
+	{
+		Syncs() : count(0) {}
+
+		void run() const
+		{
+			for(int i = 0; i < count; i++) ranges[i].segment->sync(ranges[i].from, ranges[i].to);
+		}
+
+		SyncRange ranges[2];
+		int       count;
+	};
+
+	template <class U>
+	void push_value(U && value);
+
+	void spill(const T & value, Syncs & syncs);
+	void claim_sync(Syncs & syncs);
+	void refill();
+	Result take();
+
+	SpillOptions            options_;
+	std::condition_variable cond_;
+	mutable std::mutex      mutex_;
+	RingBuffer<T>           window_;
+	bool                    dying_;
+	std::size_t             waiting_;
+
+	//
+	// the log, oldest segment first. all of it goes with mutex_
+	//
+	std::deque<SegmentPtr> segments_;
+	std::size_t            spilled_;
+	std::size_t            spilled_bytes_;
+	std::size_t            unsynced_;
+	Clock::time_point      last_sync_;
+	std::string            scratch_;
+
+	static constexpr auto ERR_SPILLING_QUEUE_NO_WINDOW =
+		"a bad programmer tried to make a spilling queue without any room "
+		"in memory"
+		;
+
+	static constexpr auto ERR_SPILLING_QUEUE_RECORD_TOO_BIG =
+		"a bad programmer tried to spill a value that serializes to 4 GiB "
+		"or more"
+		;
+
+};
+
+template <class T, class Serializer> SpillingQueue<T, Serializer>::SpillingQueue(const SpillOptions & options) :
+	options_(options),
+	window_(options.window),
+	dying_(false),
+	waiting_(0),
+	spilled_(0),
+	spilled_bytes_(0),
+	unsynced_(0),
+	last_sync_(Clock::now())
+{
+	if(options.window == 0)
+	{
+		throw std::runtime_error(ERR_SPILLING_QUEUE_NO_WINDOW);
+	}
+}
+
+template <class T, class Serializer> void SpillingQueue<T, Serializer>::kill()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	dying_ = true;
+
+	cond_.notify_all();
+}
+
+template <class T, class Serializer> void SpillingQueue<T, Serializer>::push(T && value)
+{
+	push_value(std::move(value));
+}
+
+//
+// a value that spills is only serialized, never copied
+//
+template <class T, class Serializer> void SpillingQueue<T, Serializer>::push(const T & value)
+{
+	push_value(value);
+}
+
+template <class T, class Serializer>
+template <class... Args>
+void SpillingQueue<T, Serializer>::emplace(Args &&... args)
+{
+	push_value(T(std::forward<Args>(args)...));
+}
+
+template <class T, class Serializer>
+template <class U>
+void SpillingQueue<T, Serializer>::push_value(U && value)
+{
+	Syncs syncs;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if(spilled_ == 0 && window_.size() < options_.window)
+		{
+			window_.emplace_back(std::forward<U>(value));
+		}
+		else
+		{
+			spill(value, syncs);
+		}
+
+		if(waiting_ > 0) cond_.notify_one();
+	}
+
+	syncs.run();
+}
+
+template <class T, class Serializer> auto SpillingQueue<T, Serializer>::pop() -> Result
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while(!dying_ && window_.empty())
+	{
+		waiting_++;
+
+		cond_.wait(lock);
+
+		waiting_--;
+	}
+
+	if(dying_) return Result();
+
+	return take();
+}
+
+template <class T, class Serializer> auto SpillingQueue<T, Serializer>::try_pop() -> Result
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if(dying_ || window_.empty()) return Result();
+
+	return take();
+}
+
+template <class T, class Serializer>
+template <class Rep, class Period>
+auto SpillingQueue<T, Serializer>::pop_for(const std::chrono::duration<Rep, Period> & timeout) -> Result
+{
+	const auto deadline = Clock::now() + timeout;
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while(!dying_ && window_.empty())
+	{
+		waiting_++;
+
+		const auto status = cond_.wait_until(lock, deadline);
+
+		waiting_--;
+
+		if(status == std::cv_status::timeout && window_.empty()) return Result();
+	}
+
+	if(dying_) return Result();
+
+	return take();
+}
+
+template <class T, class Serializer> std::size_t SpillingQueue<T, Serializer>::size() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return window_.size() + spilled_;
+}
+
+template <class T, class Serializer> std::size_t SpillingQueue<T, Serializer>::spilled() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return spilled_;
+}
+
+template <class T, class Serializer> std::size_t SpillingQueue<T, Serializer>::spilled_bytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return spilled_bytes_;
+}
+
+template <class T, class Serializer> void SpillingQueue<T, Serializer>::spill(const T & value, Syncs & syncs)
+{
+	scratch_.clear();
+
+	Serializer::write(value, scratch_);
+
+	if(scratch_.size() > Segment::MAX_RECORD)
+	{
+		throw std::runtime_error(ERR_SPILLING_QUEUE_RECORD_TOO_BIG);
+	}
+
+	if(segments_.empty() || !segments_.back()->fits(scratch_.size()))
+	{
+		const auto needed = Segment::RECORD_HEADER + scratch_.size();
+
+		SegmentPtr segment(new Segment(options_.directory, std::max(options_.segment_size, needed)));
+
+		claim_sync(syncs);
+
+		segments_.push_back(std::move(segment));
+	}
+
+	segments_.back()->append(scratch_);
+
+	spilled_++;
+	spilled_bytes_ += Segment::RECORD_HEADER + scratch_.size();
+	unsynced_++;
+
+	const auto now = options_.sync_interval.count() > 0 ? Clock::now() : last_sync_;
+
+	if((options_.sync_every > 0 && unsynced_ >= options_.sync_every) ||
+		(options_.sync_interval.count() > 0 && now - last_sync_ >= options_.sync_interval))
+	{
+		claim_sync(syncs);
+	}
+}
+
+//
+// hands what's been written to the last segment since its last sync over to
+// [syncs], for the push to msync once it's let go of the lock
+//
+template <class T, class Serializer> void SpillingQueue<T, Serializer>::claim_sync(Syncs & syncs)
+{
+	if(unsynced_ == 0 || segments_.empty()) return;
+
+	unsynced_ = 0;
+
+	if(options_.sync_every == 0 && options_.sync_interval.count() == 0) return;
+
+	auto & segment = segments_.back();
+
+	syncs.ranges[syncs.count++] = SyncRange { segment, segment->synced_pos, segment->write_pos };
+
+	segment->synced_pos = segment->write_pos;
+	last_sync_          = Clock::now();
+}
+
+//
+// reads values back in from the log until the window's full again. a segment
+// is dropped once it's been read to the end and isn't being written to. when
+// the whole log has been read, the last segment is rewound so it can be
+// reused
+//
+template <class T, class Serializer> void SpillingQueue<T, Serializer>::refill()
+{
+	while(spilled_ > 0 && window_.size() < options_.window)
+	{
+		auto & segment = *segments_.front();
+
+		if(segment.read_pos == segment.write_pos)
+		{
+			segments_.pop_front();
+
+			continue;
+		}
+
+		std::size_t bytes;
+
+		const auto record = segment.next(&bytes);
+
+		window_.push_back(Serializer::read(record, bytes));
+
+		spilled_--;
+		spilled_bytes_ -= Segment::RECORD_HEADER + bytes;
+	}
+
+	if(spilled_ == 0 && !segments_.empty())
+	{
+		while(segments_.size() > 1) segments_.pop_front();
+
+		auto & segment = *segments_.front();
+
+		segment.write_pos  = 0;
+		segment.read_pos   = 0;
+		segment.synced_pos = 0;
+	}
+}
+
+template <class T, class Serializer> auto SpillingQueue<T, Serializer>::take() -> Result
+{
+	auto result = Result(std::move(window_.front()));
+
+	window_.pop_front();
+
+	if(spilled_ > 0) refill();
+
+	return result;
+}
+
+} // namespace rtw
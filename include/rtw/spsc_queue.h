@@ -0,0 +1,363 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <rtw/meta.hpp>
+#include <rtw/page_block.hpp>
+#include <rtw/parking_lot.h>
+#include <rtw/sync_queue.h>
+
+namespace rtw
+{
+
+//
+// a bounded queue for exactly one producer thread and one consumer thread.
+// neither side ever waits for the other or does a read-modify-write, it's
+// just a load and a store of an index each
+//
+// each side keeps its own copy of the other side's index and only reloads it
+// when the copy says the ring is full (or empty), so in the steady state the
+// two threads hardly touch each other's cache lines
+//
+// the producer can also stage a batch of values and publish them with one
+// store, so the consumer sees the lot at once:
+//``````````````````````````````````````````````````````````````````````````````
+//	while(ring.try_stage(parse(line))) {}
+//
+//	ring.publish();
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+// with huge_pages the ring asks for huge pages (see PageBlock), which saves
+// TLB misses on big rings
+//
+// try_push, try_stage and publish must only be called from the producer,
+// try_pop only from the consumer
+//
+template <class T>
+class SpscRing : private meta::NoCopy
+{
+
+	static_assert(
+		std::is_nothrow_move_constructible<T>::value &&
+		std::is_nothrow_move_assignable<T>::value,
+		"SpscRing items have to be nothrow movable");
+
+	static_assert(
+		alignof(T) <= detail::CACHE_LINE,
+		"SpscRing items can't be aligned to more than a cache line");
+
+public:
+
+	//
+	// the capacity gets rounded up to a power of two
+	//
+	explicit SpscRing(std::size_t capacity = 1024, bool huge_pages = false);
+	~SpscRing();
+
+	//
+	// try_stage and publish in one go
+	//
+	bool try_push(T && value, std::memory_order order = std::memory_order_release)
+	{
+		if(!try_stage(std::move(value))) return false;
+
+		publish(order);
+
+		return true;
+	}
+
+	//
+	// writes [value] into the ring without letting the consumer see it yet.
+	// false (and [value] is left alone) if the ring is full
+	//
+	bool try_stage(T && value);
+
+	//
+	// lets the consumer see everything staged so far
+	//
+	// [order] here and in try_pop is for the index store that hands slots to
+	// the other side. release is all the ring needs. SpscQueue asks for
+	// seq_cst so it can check for a parked thread without a fence
+	//
+	void publish(std::memory_order order = std::memory_order_release) { tail_.store(write_, order); }
+
+	//
+	// false if there's nothing published to pop
+	//
+	bool try_pop(T & value, std::memory_order order = std::memory_order_release);
+
+	//
+	// only a snapshot, and it doesn't count staged values
+	//
+	std::size_t size() const;
+
+	std::size_t capacity() const { return mask_ + 1; }
+
+	bool huge_pages() const { return block_.huge(); }
+
+private:
+
+	T * slot(std::size_t index) const { return static_cast<T *>(block_.data()) + (index & mask_); }
+
+	PageBlock                block_;
+	std::size_t              mask_;
+
+	//
+	// the producer's line: the published tail, plus what only the producer
+	// touches
+	//
+	char                     pad0_[detail::CACHE_LINE];
+	std::atomic<std::size_t> tail_;
+	std::size_t              write_;
+	std::size_t              cached_head_;
+
+	//
+	// the consumer's line
+	//
+	char                     pad1_[detail::CACHE_LINE - sizeof(std::atomic<std::size_t>) - 2 * sizeof(std::size_t)];
+	std::atomic<std::size_t> head_;
+	std::size_t              cached_tail_;
+	char                     pad2_[detail::CACHE_LINE - sizeof(std::atomic<std::size_t>) - sizeof(std::size_t)];
+
+};
+
+template <class T> SpscRing<T>::SpscRing(std::size_t capacity, bool huge_pages) :
+	mask_(0),
+	tail_(0),
+	write_(0),
+	cached_head_(0),
+	head_(0),
+	cached_tail_(0)
+{
+	std::size_t pow2 = 2;
+
+	while(pow2 < capacity) pow2 <<= 1;
+
+	mask_  = pow2 - 1;
+	block_ = PageBlock(pow2 * sizeof(T), huge_pages);
+}
+
+//
+// staged values that were never published get destroyed too
+//
+template <class T> SpscRing<T>::~SpscRing()
+{
+	for(auto i = head_.load(std::memory_order_relaxed); i != write_; i++)
+	{
+		slot(i)->~T();
+	}
+}
+
+template <class T> bool SpscRing<T>::try_stage(T && value)
+{
+	if(write_ - cached_head_ == capacity())
+	{
+		cached_head_ = head_.load(std::memory_order_acquire);
+
+		if(write_ - cached_head_ == capacity()) return false;
+	}
+
+	new (slot(write_)) T(std::move(value));
+
+	write_++;
+
+	return true;
+}
+
+template <class T> bool SpscRing<T>::try_pop(T & value, const std::memory_order order)
+{
+	const auto head = head_.load(std::memory_order_relaxed);
+
+	if(head == cached_tail_)
+	{
+		cached_tail_ = tail_.load(std::memory_order_acquire);
+
+		if(head == cached_tail_) return false;
+	}
+
+	const auto item = slot(head);
+
+	value = std::move(*item);
+
+	item->~T();
+
+	head_.store(head + 1, order);
+
+	return true;
+}
+
+template <class T> std::size_t SpscRing<T>::size() const
+{
+	const auto head = head_.load(std::memory_order_relaxed);
+	const auto tail = tail_.load(std::memory_order_relaxed);
+
+	return tail > head ? tail - head : 0;
+}
+
+//
+// an SpscRing with SyncQueue's push/pop/kill, so a pipeline stage can swap one
+// for the other. waiting works the same as MpmcQueue: spin for a bit, then
+// park. push_range publishes the whole range with one store and one wakeup
+//
+// it's bounded, so push() waits while the queue is full. a value that's still
+// waiting when the queue is killed is thrown away
+//
+template <class T>
+class SpscQueue : private meta::NoCopy
+{
+
+public:
+
+	using Result = SyncQueueResult<T>;
+
+	explicit SpscQueue(std::size_t capacity = 1024, bool huge_pages = false);
+
+	//
+	// callable from any thread
+	//
+	void kill();
+
+	//
+	// producer only
+	//
+	void push(T && value);
+	bool try_push(T && value);
+
+	template <class Iterator>
+	void push_range(Iterator first, Iterator last);
+
+	//
+	// consumer only
+	//
+	Result pop();
+	Result try_pop();
+
+	std::size_t size() const { return ring_.size(); }
+	std::size_t capacity() const { return ring_.capacity(); }
+
+private:
+
+	SpscRing<T>       ring_;
+	std::atomic<bool> dying_;
+	detail::Waiters   consumer_;
+	detail::Waiters   producer_;
+
+};
+
+template <class T> SpscQueue<T>::SpscQueue(std::size_t capacity, bool huge_pages) :
+	ring_(capacity, huge_pages),
+	dying_(false)
+{
+}
+
+//
+// wakes whoever is waiting in push() or pop(). pop() returns a 'dead' result
+// from then on
+//
+template <class T> void SpscQueue<T>::kill()
+{
+	dying_.store(true, std::memory_order_seq_cst);
+
+	consumer_.notify_all();
+	producer_.notify_all();
+}
+
+template <class T> bool SpscQueue<T>::try_push(T && value)
+{
+	if(!ring_.try_push(std::move(value), std::memory_order_seq_cst)) return false;
+
+	consumer_.notify_after_seq_cst();
+
+	return true;
+}
+
+template <class T> void SpscQueue<T>::push(T && value)
+{
+	auto pushed = false;
+
+	producer_.wait([this, &value, &pushed]()
+	{
+		pushed = ring_.try_push(std::move(value), std::memory_order_seq_cst);
+
+		return pushed || dying_.load(std::memory_order_acquire);
+	});
+
+	if(pushed) consumer_.notify_after_seq_cst();
+}
+
+template <class T>
+template <class Iterator>
+void SpscQueue<T>::push_range(Iterator first, Iterator last)
+{
+	auto staged = false;
+
+	for(; first != last; ++first)
+	{
+		T value(std::move(*first));
+
+		if(ring_.try_stage(std::move(value)))
+		{
+			staged = true;
+
+			continue;
+		}
+
+		//
+		// full. let the consumer at what's there and wait for room
+		//
+		if(staged)
+		{
+			ring_.publish(std::memory_order_seq_cst);
+			consumer_.notify_after_seq_cst();
+
+			staged = false;
+		}
+
+		push(std::move(value));
+	}
+
+	if(staged)
+	{
+		ring_.publish(std::memory_order_seq_cst);
+		consumer_.notify_after_seq_cst();
+	}
+}
+
+template <class T> auto SpscQueue<T>::pop() -> Result
+{
+	T value;
+
+	auto popped = false;
+
+	consumer_.wait([this, &value, &popped]()
+	{
+		if(dying_.load(std::memory_order_acquire)) return true;
+
+		popped = ring_.try_pop(value, std::memory_order_seq_cst);
+
+		return popped;
+	});
+
+	if(!popped) return Result();
+
+	producer_.notify_after_seq_cst();
+
+	return Result(std::move(value));
+}
+
+template <class T> auto SpscQueue<T>::try_pop() -> Result
+{
+	T value;
+
+	if(dying_.load(std::memory_order_acquire) || !ring_.try_pop(value, std::memory_order_seq_cst)) return Result();
+
+	producer_.notify_after_seq_cst();
+
+	return Result(std::move(value));
+}
+
+} // namespace rtw
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+#include <rtw/future.h>
+#include <rtw/meta.hpp>
+#include <rtw/ring_buffer.h>
+#include <rtw/task_allocator.h>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// the shared part of a Strand. it's also the task that goes in the executor's
+// queue whenever the strand has work, and it runs the strand's tasks one after
+// another until it runs out (or has had a fair go and gets back in line)
+//
+// while it's queued or running it holds a reference to itself, so a Strand
+// can go away with tasks still pending and they'll still run
+//
+class StrandCore final : public Task, public Pooled, private meta::NoCopy
+{
+
+public:
+
+	//
+	// how many tasks a strand runs before it goes to the back of the queue
+	// so one busy strand can't hog a worker
+	//
+	static constexpr int MAX_BATCH = 64;
+
+	explicit StrandCore(Executor * executor) :
+		executor_(executor),
+		queue_(4),
+		scheduled_(false),
+		refs_(1)
+	{
+	}
+
+	void post(Task * task);
+
+	void run() override;
+	void discard() override;
+
+	void add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+	void release()
+	{
+		if(refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+	}
+
+	Executor * executor() const { return executor_; }
+
+	//
+	// the strand whose task the calling thread is running, if any
+	//
+	static StrandCore *& current()
+	{
+		static thread_local StrandCore * strand = nullptr;
+
+		return strand;
+	}
+
+private:
+
+	~StrandCore() {}
+
+	Executor *         executor_;
+	std::mutex         mutex_;
+	RingBuffer<Task *> queue_;
+
+	//
+	// true while the strand is in the executor's queue or running. goes with
+	// mutex_
+	//
+	bool               scheduled_;
+
+	std::atomic<int>   refs_;
+
+};
+
+inline void StrandCore::post(Task * const task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		queue_.emplace_back(task);
+
+		if(scheduled_) return;
+
+		scheduled_ = true;
+	}
+
+	add_ref();
+
+	executor_->execute(TaskPtr(this));
+}
+
+inline void StrandCore::run()
+{
+	const auto outer = current();
+
+	current() = this;
+
+	auto more = false;
+
+	for(int ran = 0;; ran++)
+	{
+		Task * task;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if(queue_.empty())
+			{
+				scheduled_ = false;
+
+				break;
+			}
+
+			if(ran == MAX_BATCH)
+			{
+				more = true;
+
+				break;
+			}
+
+			task = queue_.front();
+
+			queue_.pop_front();
+		}
+
+		task->run();
+	}
+
+	current() = outer;
+
+	//
+	// still scheduled, and our reference goes back in the queue with us
+	//
+	if(more) executor_->execute(TaskPtr(this));
+	else release();
+}
+
+inline void StrandCore::discard()
+{
+	RingBuffer<Task *> pending(1);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		while(!queue_.empty())
+		{
+			pending.emplace_back(queue_.front());
+
+			queue_.pop_front();
+		}
+
+		scheduled_ = false;
+	}
+
+	while(!pending.empty())
+	{
+		pending.front()->discard();
+		pending.pop_front();
+	}
+
+	release();
+}
+
+} // namespace detail
+
+//
+// runs tasks on an executor (usually a ThreadPool) one at a time, in the order
+// they were posted. any of the pool's workers can pick them up, but never two
+// at once, so state that's only touched from one strand doesn't need a lock
+//
+// an idle strand is just a few words of memory: it doesn't hold a thread or
+// sit in the pool's queues, so there can be as many of them as there are
+// sessions, shards or whatever
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::Strand session_strand(pool);
+//
+//	session_strand.async([&session, message] { session.handle(message); });
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+// destroying a Strand doesn't cancel anything, tasks already posted still run
+//
+class Strand : private meta::NoCopy
+{
+
+public:
+
+	explicit Strand(detail::Executor & executor) :
+		core_(new detail::StrandCore(&executor))
+	{
+	}
+
+	Strand(Strand && rhs) : core_(rhs.core_) { rhs.core_ = nullptr; }
+
+	Strand & operator=(Strand && rhs)
+	{
+		if(this != &rhs)
+		{
+			reset();
+
+			core_ = rhs.core_;
+			rhs.core_ = nullptr;
+		}
+
+		return *this;
+	}
+
+	~Strand() { reset(); }
+
+	template <class Function, class... Args>
+	using FutureFor =
+		Future<
+			result_of_t<
+				typename std::decay<Function>::type,
+				typename std::decay<Args>::type...>>;
+
+	//
+	// same as ThreadPool::async, except f runs on the strand. its future's
+	// continuations (then) go to the strand's executor
+	//
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> async(Function && f, Args &&... args)
+	{
+		using State =
+			detail::TaskState<
+				typename std::decay<Function>::type,
+				typename std::decay<Args>::type...>;
+
+		const auto state = State::make(std::forward<Function>(f), std::forward<Args>(args)...);
+
+		state->set_executor(core_->executor());
+
+		FutureFor<Function, Args...> future(state);
+
+		core_->post(state);
+
+		return future;
+	}
+
+	//
+	// true if the calling thread is in the middle of one of this strand's
+	// tasks
+	//
+	bool running_in_this_thread() const
+	{
+		return core_ && detail::StrandCore::current() == core_;
+	}
+
+private:
+
+	void reset()
+	{
+		if(core_) core_->release();
+
+		core_ = nullptr;
+	}
+
+	detail::StrandCore * core_;
+
+};
+
+} // namespace rtw
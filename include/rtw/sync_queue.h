@@ -1,14 +1,54 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
 #include <mutex>
-#include <queue>
 
+#include <rtw/futex.hpp>
 #include <rtw/meta.hpp>
+#include <rtw/parking_lot.h>
+#include <rtw/ring_buffer.h>
 
 namespace rtw
 {
 
+class QueueSelector;
+
+namespace detail
+{
+
+//
+// something that wants to hear when a SyncQueue gets a value after being
+// empty, or gets killed (see QueueSelector), and maybe when it's emptied
+// again (see PollableQueue)
+//
+// both are called with the queue's lock held, so they mustn't touch the queue
+//
+class QueueWatcher
+{
+
+public:
+
+	virtual void queue_ready() = 0;
+
+	//
+	// not called once the queue has been killed, it stays ready from then on
+	//
+	virtual void queue_drained() {}
+
+protected:
+
+	~QueueWatcher() {}
+
+};
+
+} // namespace detail
+
 //
 // the result of a SyncQueue::pop operation
 //
@@ -54,22 +94,162 @@ private:
 
 };
 
+//
+// a snapshot of a SyncQueue, from SyncQueue::stats()
+//
+struct SyncQueueStats
+{
+	std::size_t size;
+
+	//
+	// the most there's ever been in the queue at once
+	//
+	std::size_t high_water;
+
+	std::size_t pushes;
+	std::size_t pops;
+
+	//
+	// how many times push or pop found the mutex already taken and had to
+	// wait for it
+	//
+	std::size_t contended;
+
+	//
+	// 0 for an unbounded queue
+	//
+	std::size_t capacity;
+
+	//
+	// values thrown away by Overflow::DropOldest, and pushes turned away by
+	// try_push or push_for because the queue was full
+	//
+	std::size_t dropped;
+	std::size_t rejected;
+};
+
+//
+// what push() does when a bounded SyncQueue is full
+//
+// try_push and push_for never wait longer than they're told to, whatever the
+// policy
+//
+enum class Overflow
+{
+	//
+	// wait for a consumer to make room
+	//
+	Block,
+
+	//
+	// throw away the oldest value to make room. for things like telemetry,
+	// where the newest value is the one that matters
+	//
+	DropOldest,
+};
+
+//
+// how a consumer waits for an empty SyncQueue to get something
+//
+enum class Wait
+{
+	//
+	// sleep on a condition variable. cheapest on cpu, but every handoff to a
+	// sleeping consumer pays for a wake up
+	//
+	Sleep,
+
+	//
+	// spin for a few microseconds first (it often doesn't take longer than
+	// that under load), then park on a futex. producers only make the wake
+	// syscall when a consumer has actually gone to sleep
+	//
+	Spin,
+};
+
 //
 // clients should always call kill() before the SyncQueue object is destroyed
 //
+// by default a SyncQueue grows as much as it needs to. give it a capacity and
+// it never holds more than that, so a burst of producers can't run the
+// process out of memory. the space for [capacity] values is allocated up
+// front, so a full queue doesn't cost anything more:
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::SyncQueue<Frame> frames(64, rtw::Overflow::DropOldest);
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+// once a bounded queue has been killed, a push that would have to wait for
+// room throws its value away instead
+//
+// for latency sensitive handoffs pick Wait::Spin, which burns some cpu in an
+// idle consumer to save it the wake up:
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::SyncQueue<Order> orders(rtw::Wait::Spin);
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
 template <class T>
 class SyncQueue
 {
 
 public:
 
-	using Result = SyncQueueResult<T>;
+	using Result   = SyncQueueResult<T>;
+	using Deadline = std::chrono::steady_clock::time_point;
+
+	SyncQueue() : SyncQueue(Wait::Sleep) {}
 
-	SyncQueue();
+	explicit SyncQueue(Wait wait);
+	explicit SyncQueue(std::size_t capacity, Overflow overflow = Overflow::Block, Wait wait = Wait::Sleep);
 	
 	void kill();
 	void push(T && value);
+
+	template <class... Args>
+	void emplace(Args &&... args);
+
+	//
+	// false, and [value] is left alone, if the queue is full (and the policy
+	// is Block) or it's still full after [timeout]
+	//
+	bool try_push(T && value);
+
+	template <class Rep, class Period>
+	bool push_for(T && value, const std::chrono::duration<Rep, Period> & timeout);
+
+	template <class Iterator>
+	std::size_t push_range(Iterator first, Iterator last);
+
 	Result pop();
+	Result try_pop();
+
+	template <class Rep, class Period>
+	Result pop_for(const std::chrono::duration<Rep, Period> & timeout);
+
+	template <class OutputIterator>
+	std::size_t pop_bulk(OutputIterator out, std::size_t max);
+
+	std::size_t size() const;
+
+	//
+	// 0 for an unbounded queue
+	//
+	std::size_t capacity() const { return capacity_; }
+
+	//
+	// doesn't take the lock, so it never gets in the way of a push or pop.
+	// the fields are read one at a time, so a snapshot taken while the queue
+	// is busy needn't add up exactly
+	//
+	SyncQueueStats stats() const;
+
+protected:
+
+	//
+	// for QueueSelector and PollableQueue. a queue has one watcher at most,
+	// so setting one while there's already one (even the same one) throws.
+	// nullptr takes it off
+	//
+	void watch(detail::QueueWatcher * watcher);
 
 private:
 
@@ -79,19 +259,133 @@ private:
 	Result pop_successful_result();
 	Result make_dead_result();
 
+	bool wait_for_item(std::unique_lock<std::mutex> & lock);
+	std::cv_status wait_for_push(std::unique_lock<std::mutex> & lock, Deadline deadline);
+	std::cv_status spin_then_park(std::uint32_t seen, Deadline deadline);
+	void wake_consumers(std::size_t count);
+	bool make_room(std::unique_lock<std::mutex> & lock, Deadline deadline);
+	bool push_until(T && value, Deadline deadline);
+
+	std::unique_lock<std::mutex> lock_counted() const;
+	void pushed();
+	void popped(std::size_t count);
+
+	bool readable() const;
+
 	std::condition_variable cond_;
-	std::mutex              push_pop_mutex_;
-	std::queue<T>           queue_;
+	mutable std::mutex      push_pop_mutex_;
+	RingBuffer<T>           queue_;
 	bool                    dying_;
+
+	//
+	// consumers waiting for a push, so producers know whether there's anybody
+	// to wake (and push_range how many). goes with push_pop_mutex_
+	//
+	std::size_t             waiting_;
+
+	//
+	// for Wait::Spin. producers bump signal_ (under push_pop_mutex_) when
+	// there's a consumer waiting, and consumers spin and then sleep on it.
+	// sleepers_ is the ones actually in the futex, the only ones that need
+	// the syscall to wake
+	//
+	const Wait                 wait_;
+	std::atomic<std::uint32_t> signal_;
+	std::atomic<std::uint32_t> sleepers_;
+
+	//
+	// the bound, if there is one (0 if not), and the producers waiting in
+	// room_ for a consumer to make some. goes with push_pop_mutex_
+	//
+	const std::size_t       capacity_;
+	const Overflow          overflow_;
+	std::condition_variable room_;
+	std::size_t             waiting_for_room_;
+
+	//
+	// for stats(), which reads them without the lock. all but contended_ are
+	// only written under push_pop_mutex_, so they're bumped with a plain
+	// load and store rather than a locked add. size_ follows queue_.size()
+	//
+	std::atomic<std::size_t>         size_;
+	std::atomic<std::size_t>         high_water_;
+	std::atomic<std::size_t>         pushes_;
+	std::atomic<std::size_t>         pops_;
+	std::atomic<std::size_t>         dropped_;
+	std::atomic<std::size_t>         rejected_;
+	mutable std::atomic<std::size_t> contended_;
+
+	static void bump(std::atomic<std::size_t> & counter, const std::size_t amount)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	//
+	// the QueueSelector watching this queue, if there is one. goes with
+	// push_pop_mutex_
+	//
+	detail::QueueWatcher *           watcher_;
+
+	static constexpr auto ERR_SYNC_QUEUE_ZERO_CAPACITY =
+		"a bad programmer tried to make a bounded synchronized queue that "
+		"can't hold anything"
+		;
+
+	static constexpr auto ERR_SYNC_QUEUE_WATCHED_TWICE =
+		"a bad programmer tried to put a synchronized queue in a selector "
+		"it's already in (this one or another)"
+		;
+
+friend class QueueSelector;
 	
 };
 
-template <class T> SyncQueue<T>::SyncQueue() :
-	dying_(false)
+template <class T> SyncQueue<T>::SyncQueue(const Wait wait) :
+	dying_(false),
+	waiting_(0),
+	wait_(wait),
+	signal_(0),
+	sleepers_(0),
+	capacity_(0),
+	overflow_(Overflow::Block),
+	waiting_for_room_(0),
+	size_(0),
+	high_water_(0),
+	pushes_(0),
+	pops_(0),
+	dropped_(0),
+	rejected_(0),
+	contended_(0),
+	watcher_(nullptr)
 {
 	// nothing
 }
 
+template <class T> SyncQueue<T>::SyncQueue(const std::size_t capacity, const Overflow overflow, const Wait wait) :
+	queue_(capacity),
+	dying_(false),
+	waiting_(0),
+	wait_(wait),
+	signal_(0),
+	sleepers_(0),
+	capacity_(capacity),
+	overflow_(overflow),
+	waiting_for_room_(0),
+	size_(0),
+	high_water_(0),
+	pushes_(0),
+	pops_(0),
+	dropped_(0),
+	rejected_(0),
+	contended_(0),
+	watcher_(nullptr)
+{
+	if(capacity == 0)
+	{
+		throw std::runtime_error(ERR_SYNC_QUEUE_ZERO_CAPACITY);
+	}
+}
+
 //
 // notifies all consumers waiting in pop() that the SyncQueue is
 // dying. pop() will return a 'dead' result
@@ -102,7 +396,11 @@ template <class T> void SyncQueue<T>::kill()
 
 	dying_ = true;
 
-	cond_.notify_all();
+	wake_consumers(waiting_);
+
+	room_.notify_all();
+
+	if(watcher_) watcher_->queue_ready();
 }
 
 //
@@ -110,48 +408,494 @@ template <class T> void SyncQueue<T>::kill()
 //
 template <class T> void SyncQueue<T>::push(T && value)
 {
-	std::lock_guard<std::mutex> push_lock(push_pop_mutex_);
+	emplace(std::move(value));
+}
+
+//
+// like push() but builds the value in the queue from [args]. they're used
+// under the lock, so keep the constructor cheap
+//
+template <class T>
+template <class... Args>
+void SyncQueue<T>::emplace(Args &&... args)
+{
+	auto push_lock = lock_counted();
+
+	if(!make_room(push_lock, Deadline::max())) return;
+
+	queue_.emplace_back(std::forward<Args>(args)...);
+
+	pushed();
+
+	wake_consumers(1);
+}
+
+template <class T> bool SyncQueue<T>::try_push(T && value)
+{
+	return push_until(std::move(value), Deadline::min());
+}
+
+template <class T>
+template <class Rep, class Period>
+bool SyncQueue<T>::push_for(T && value, const std::chrono::duration<Rep, Period> & timeout)
+{
+	return push_until(std::move(value), std::chrono::steady_clock::now() + timeout);
+}
+
+//
+// moves (not copies) a whole range onto the queue under one lock and wakes
+// as many consumers as there are new values (or waiting consumers, if that's
+// fewer)
+//
+// returns how many values went in, which is only short of the whole range if
+// a bounded queue got killed while this was waiting for room
+//
+template <class T>
+template <class Iterator>
+std::size_t SyncQueue<T>::push_range(Iterator first, Iterator last)
+{
+	auto push_lock = lock_counted();
+
+	std::size_t count = 0;
+
+	for(; first != last; ++first, ++count)
+	{
+		if(!make_room(push_lock, Deadline::max())) break;
 
-	queue_.push(std::forward<T>(value));
+		queue_.push_back(T(std::move(*first)));
 
-	cond_.notify_one();
+		pushed();
+	}
+
+	wake_consumers(count);
+
+	return count;
 }
 
 template <class T> auto SyncQueue<T>::pop() -> Result
 {
-	std::unique_lock<std::mutex> pop_lock(push_pop_mutex_);
+	auto pop_lock = lock_counted();
+
+	if(!wait_for_item(pop_lock)) return make_dead_result();
+
+	return pop_successful_result();
+}
+
+//
+// like pop() but returns a 'dead' result straight away instead of waiting
+// when the queue is empty
+//
+template <class T> auto SyncQueue<T>::try_pop() -> Result
+{
+	const auto pop_lock = lock_counted();
+
+	if(dying_ || queue_.empty()) return make_dead_result();
+
+	return pop_successful_result();
+}
+
+//
+// like pop() but gives up and returns a 'dead' result once [timeout] has
+// passed. tell a timeout from a kill with another pop_for (or try_pop) if it
+// matters
+//
+template <class T>
+template <class Rep, class Period>
+auto SyncQueue<T>::pop_for(const std::chrono::duration<Rep, Period> & timeout) -> Result
+{
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+	auto pop_lock = lock_counted();
 
-	//
-	// if the SyncQueue was already killed then just return a 'dead' result
-	//
 	if(dying_) return make_dead_result();
 
 	while(queue_.empty())
 	{
+		const auto status = wait_for_push(pop_lock, deadline);
+
+		if(dying_) return make_dead_result();
+
+		if(status == std::cv_status::timeout && queue_.empty()) return make_dead_result();
+	}
+
+	return pop_successful_result();
+}
+
+//
+// waits like pop() for at least one value, then moves up to [max] values to
+// [out] under the same lock. returns how many it moved, which is 0 only once
+// the queue has been killed (or if [max] is 0)
+//``````````````````````````````````````````````````````````````````````````````
+//	std::vector<Record> batch;
+//
+//	while(queue.pop_bulk(std::back_inserter(batch), 256))
+//	{
+//		writer.write(batch);
+//
+//		batch.clear();
+//	}
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+template <class T>
+template <class OutputIterator>
+std::size_t SyncQueue<T>::pop_bulk(OutputIterator out, const std::size_t max)
+{
+	if(max == 0) return 0;
+
+	auto pop_lock = lock_counted();
+
+	if(!wait_for_item(pop_lock)) return 0;
+
+	std::size_t count = 0;
+
+	while(count < max && !queue_.empty())
+	{
+		*out = std::move(queue_.front());
+
+		++out;
+
+		queue_.pop_front();
+
+		count++;
+	}
+
+	popped(count);
+
+	return count;
+}
+
+template <class T> std::size_t SyncQueue<T>::size() const
+{
+	std::lock_guard<std::mutex> lock(push_pop_mutex_);
+
+	return queue_.size();
+}
+
+template <class T> SyncQueueStats SyncQueue<T>::stats() const
+{
+	SyncQueueStats stats;
+
+	stats.size       = size_.load(std::memory_order_relaxed);
+	stats.high_water = high_water_.load(std::memory_order_relaxed);
+	stats.pushes     = pushes_.load(std::memory_order_relaxed);
+	stats.pops       = pops_.load(std::memory_order_relaxed);
+	stats.contended  = contended_.load(std::memory_order_relaxed);
+	stats.capacity   = capacity_;
+	stats.dropped    = dropped_.load(std::memory_order_relaxed);
+	stats.rejected   = rejected_.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+//
+// try_lock first so contention gets counted. when there isn't any this costs
+// the same as a plain lock
+//
+template <class T> std::unique_lock<std::mutex> SyncQueue<T>::lock_counted() const
+{
+	std::unique_lock<std::mutex> lock(push_pop_mutex_, std::try_to_lock);
+
+	if(!lock.owns_lock())
+	{
+		contended_.fetch_add(1, std::memory_order_relaxed);
+
+		lock.lock();
+	}
+
+	return lock;
+}
+
+//
+// waits until there's something in the queue. false if the SyncQueue was
+// killed before (or while) waiting
+//
+template <class T> bool SyncQueue<T>::wait_for_item(std::unique_lock<std::mutex> & lock)
+{
+	if(dying_) return false;
+
+	while(queue_.empty())
+	{
+		wait_for_push(lock, Deadline::max());
+
 		//
-		// wait for an item
+		// the SyncQueue started dying when we were waiting for an item
 		//
-		cond_.wait(pop_lock);
+		if(dying_) return false;
+	}
 
+	return true;
+}
+
+//
+// one go at waiting for a push (or a kill), until [deadline] at the latest.
+// called with the queue empty, and it can return for no reason at all, so the
+// caller checks again
+//
+template <class T> std::cv_status SyncQueue<T>::wait_for_push(std::unique_lock<std::mutex> & lock, const Deadline deadline)
+{
+	auto status = std::cv_status::no_timeout;
+
+	waiting_++;
+
+	if(wait_ == Wait::Spin)
+	{
 		//
-		// the SyncQueue started dying when we were waiting for an item. return
-		// a 'dead' result
+		// a push from here on bumps signal_, because it sees waiting_
 		//
-		if(dying_) return make_dead_result();
+		const auto seen = signal_.load(std::memory_order_relaxed);
+
+		lock.unlock();
+
+		status = spin_then_park(seen, deadline);
+
+		lock.lock();
+	}
+	else if(deadline == Deadline::max())
+	{
+		cond_.wait(lock);
+	}
+	else
+	{
+		status = cond_.wait_until(lock, deadline);
 	}
 
-	return pop_successful_result();
+	waiting_--;
+
+	return status;
+}
+
+//
+// sleepers_ is bumped before the last look at signal_, and producers bump
+// signal_ before they look at sleepers_, so either we see the push or they
+// see us (and the futex itself covers the gap between our look and the
+// sleep)
+//
+// a timed wait looks at the clock every few spins too, so a short timeout
+// isn't stretched out to the whole spin
+//
+template <class T> std::cv_status SyncQueue<T>::spin_then_park(const std::uint32_t seen, const Deadline deadline)
+{
+	for(int spin = 0; spin < detail::spin_limit(); spin++)
+	{
+		if(signal_.load(std::memory_order_relaxed) != seen) return std::cv_status::no_timeout;
+
+		if(deadline != Deadline::max() && spin % 16 == 0 && std::chrono::steady_clock::now() >= deadline)
+		{
+			return std::cv_status::timeout;
+		}
+
+		detail::spin_pause();
+	}
+
+	auto status = std::cv_status::no_timeout;
+
+	sleepers_.fetch_add(1, std::memory_order_seq_cst);
+
+	while(signal_.load(std::memory_order_seq_cst) == seen)
+	{
+		if(deadline == Deadline::max())
+		{
+			detail::futex_wait(signal_, seen);
+
+			continue;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+
+		if(now >= deadline)
+		{
+			status = std::cv_status::timeout;
+
+			break;
+		}
+
+		detail::futex_wait_for(signal_, seen, deadline - now);
+	}
+
+	sleepers_.fetch_sub(1, std::memory_order_relaxed);
+
+	return status;
+}
+
+//
+// wakes up to [count] of the consumers waiting for a push. does nothing at
+// all if there aren't any
+//
+template <class T> void SyncQueue<T>::wake_consumers(const std::size_t count)
+{
+	if(waiting_ == 0 || count == 0) return;
+
+	if(wait_ == Wait::Spin)
+	{
+		signal_.fetch_add(1, std::memory_order_seq_cst);
+
+		if(sleepers_.load(std::memory_order_seq_cst) == 0) return;
+
+		if(count >= waiting_)
+		{
+			detail::futex_wake_all(signal_);
+		}
+		else
+		{
+			detail::futex_wake(signal_, static_cast<int>(count));
+		}
+	}
+	else if(count >= waiting_)
+	{
+		cond_.notify_all();
+	}
+	else
+	{
+		for(std::size_t i = 0; i < count; i++) cond_.notify_one();
+	}
+}
+
+//
+// gets a bounded queue ready for one more value, by dropping the oldest one or
+// by waiting (until [deadline] at the latest) for a consumer to take one,
+// depending on the policy. Deadline::min() means don't wait at all
+//
+// false if there's still no room, or the queue was killed while waiting
+//
+template <class T> bool SyncQueue<T>::make_room(std::unique_lock<std::mutex> & lock, const Deadline deadline)
+{
+	if(capacity_ == 0 || queue_.size() < capacity_) return true;
+
+	if(overflow_ == Overflow::DropOldest)
+	{
+		queue_.pop_front();
+
+		bump(dropped_, 1);
+
+		return true;
+	}
+
+	if(dying_ || deadline == Deadline::min()) return false;
+
+	//
+	// push_range only wakes consumers when it's done, so make sure nobody
+	// is asleep on what it's pushed so far
+	//
+	wake_consumers(waiting_);
+
+	while(queue_.size() >= capacity_)
+	{
+		waiting_for_room_++;
+
+		auto status = std::cv_status::no_timeout;
+
+		if(deadline == Deadline::max())
+		{
+			room_.wait(lock);
+		}
+		else
+		{
+			status = room_.wait_until(lock, deadline);
+		}
+
+		waiting_for_room_--;
+
+		if(dying_) return false;
+
+		if(status == std::cv_status::timeout && queue_.size() >= capacity_) return false;
+	}
+
+	return true;
+}
+
+template <class T> bool SyncQueue<T>::push_until(T && value, const Deadline deadline)
+{
+	auto push_lock = lock_counted();
+
+	if(!make_room(push_lock, deadline))
+	{
+		bump(rejected_, 1);
+
+		return false;
+	}
+
+	queue_.push_back(std::move(value));
+
+	pushed();
+
+	wake_consumers(1);
+
+	return true;
+}
+
+template <class T> void SyncQueue<T>::pushed()
+{
+	const auto size = queue_.size();
+
+	bump(pushes_, 1);
+
+	size_.store(size, std::memory_order_relaxed);
+
+	if(size > high_water_.load(std::memory_order_relaxed)) high_water_.store(size, std::memory_order_relaxed);
+
+	//
+	// a watcher only cares about the queue going from empty to not empty. it
+	// looks at the queue itself before it goes to sleep
+	//
+	if(watcher_ && queue_.size() == 1) watcher_->queue_ready();
 }
 
 template <class T> auto SyncQueue<T>::pop_successful_result() -> Result
 {
 	auto result = Result(std::move(queue_.front()));
 
-	queue_.pop();
-	
+	queue_.pop_front();
+
+	popped(1);
+
 	return result;
 }
 
+template <class T> void SyncQueue<T>::popped(const std::size_t count)
+{
+	bump(pops_, count);
+
+	size_.store(queue_.size(), std::memory_order_relaxed);
+
+	if(watcher_ && queue_.empty() && !dying_) watcher_->queue_drained();
+
+	if(waiting_for_room_ == 0) return;
+
+	if(count == 1)
+	{
+		room_.notify_one();
+	}
+	else
+	{
+		room_.notify_all();
+	}
+}
+
+//
+// a null [watcher] stops watching
+//
+template <class T> void SyncQueue<T>::watch(detail::QueueWatcher * const watcher)
+{
+	std::lock_guard<std::mutex> lock(push_pop_mutex_);
+
+	if(watcher && watcher_)
+	{
+		throw std::runtime_error(ERR_SYNC_QUEUE_WATCHED_TWICE);
+	}
+
+	watcher_ = watcher;
+}
+
+//
+// true if a try_pop would get something, or the queue is dead
+//
+template <class T> bool SyncQueue<T>::readable() const
+{
+	std::lock_guard<std::mutex> lock(push_pop_mutex_);
+
+	return dying_ || !queue_.empty();
+}
+
 template <class T> auto SyncQueue<T>::make_dead_result() -> Result
 {
 	return Result();
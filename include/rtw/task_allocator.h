@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// a dumb per-thread cache of fixed size blocks for task states
+//
+// blocks come in size classes of BLOCK_GRANULE bytes. each thread keeps a free
+// list per class so allocating and freeing a task state is a couple of pointer
+// swaps once the cache is warm. blocks freed on a different thread than the
+// one they were allocated on just end up in that thread's cache
+//
+// anything bigger than the biggest class goes straight to operator new
+//
+class TaskAllocator
+{
+
+public:
+
+	static constexpr std::size_t BLOCK_GRANULE   = 64;
+	static constexpr std::size_t NUM_CLASSES     = 8;
+	static constexpr std::size_t MAX_CACHED      = 1024;
+	static constexpr std::size_t MAX_BLOCK_SIZE  = BLOCK_GRANULE * NUM_CLASSES;
+
+	static void * allocate(std::size_t size);
+	static void deallocate(void * block, std::size_t size);
+
+private:
+
+	struct FreeBlock
+	{
+		FreeBlock * next;
+	};
+
+	struct FreeList
+	{
+		FreeBlock * head;
+		std::size_t count;
+	};
+
+	//
+	// trivially destructible so it's still safe to look at after the Reaper
+	// has run at thread exit
+	//
+	struct Cache
+	{
+		FreeList lists[NUM_CLASSES];
+		bool     dead;
+	};
+
+	struct Reaper
+	{
+		Reaper(Cache * cache) : cache(cache) {}
+		~Reaper();
+
+		Cache * cache;
+	};
+
+	static Cache * local_cache();
+
+	static std::size_t class_of(std::size_t size)
+	{
+		return (size + BLOCK_GRANULE - 1) / BLOCK_GRANULE - 1;
+	}
+
+};
+
+inline auto TaskAllocator::local_cache() -> Cache *
+{
+	static thread_local Cache cache;
+	static thread_local Reaper reaper(&cache);
+
+	(void)reaper;
+
+	//
+	// not through the reaper, which may be gone already
+	//
+	return cache.dead ? nullptr : &cache;
+}
+
+inline void * TaskAllocator::allocate(std::size_t size)
+{
+	if(size > MAX_BLOCK_SIZE) return ::operator new(size);
+
+	const auto size_class = class_of(size);
+	const auto cache      = local_cache();
+
+	if(cache)
+	{
+		auto & list = cache->lists[size_class];
+
+		if(list.head)
+		{
+			const auto block = list.head;
+
+			list.head = block->next;
+			list.count--;
+
+			return block;
+		}
+	}
+
+	return ::operator new((size_class + 1) * BLOCK_GRANULE);
+}
+
+inline void TaskAllocator::deallocate(void * const block, std::size_t size)
+{
+	if(size > MAX_BLOCK_SIZE)
+	{
+		::operator delete(block);
+
+		return;
+	}
+
+	const auto cache = local_cache();
+
+	if(cache)
+	{
+		auto & list = cache->lists[class_of(size)];
+
+		if(list.count < MAX_CACHED)
+		{
+			const auto free_block = static_cast<FreeBlock *>(block);
+
+			free_block->next = list.head;
+			list.head = free_block;
+			list.count++;
+
+			return;
+		}
+	}
+
+	::operator delete(block);
+}
+
+//
+// derive from this to have new/delete go through the TaskAllocator
+//
+struct Pooled
+{
+	static void * operator new(std::size_t size) { return TaskAllocator::allocate(size); }
+
+	static void operator delete(void * block, std::size_t size) { TaskAllocator::deallocate(block, size); }
+};
+
+inline TaskAllocator::Reaper::~Reaper()
+{
+	for(auto & list : cache->lists)
+	{
+		while(list.head)
+		{
+			const auto block = list.head;
+
+			list.head = block->next;
+
+			::operator delete(block);
+		}
+
+		list.count = 0;
+	}
+
+	cache->dead = true;
+}
+
+} // namespace detail
+
+} // namespace rtw
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+#include <rtw/future_util.h>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// a running estimate of how long the tasks from one call site take
+//
+// a call site is identified by the types of the function and its arguments.
+// every lambda expression has its own type, so for lambdas that really is the
+// call site. plain function pointers with the same signature share one
+//
+// the updates are racy on purpose: a lost sample here and there doesn't matter
+// and it keeps recording down to a couple of relaxed loads and stores
+//
+class TaskCost
+{
+
+public:
+
+	//
+	// nothing's considered cheap until it's been timed this many times
+	//
+	static constexpr std::uint32_t MIN_SAMPLES = 4;
+
+	//
+	// tasks that are run inline only get timed once in this many runs, since
+	// reading the clock twice isn't free next to a tiny task
+	//
+	static constexpr std::uint32_t SAMPLE_EVERY = 16;
+
+	template <class... CallSite>
+	static TaskCost & of()
+	{
+		static TaskCost cost;
+
+		return cost;
+	}
+
+	TaskCost() :
+		average_ns_(0),
+		samples_(0),
+		calls_(0)
+	{
+	}
+
+	bool cheaper_than(std::chrono::nanoseconds threshold) const
+	{
+		return
+			samples_.load(std::memory_order_relaxed) >= MIN_SAMPLES &&
+			average_ns_.load(std::memory_order_relaxed) < threshold.count();
+	}
+
+	bool should_sample()
+	{
+		return calls_.fetch_add(1, std::memory_order_relaxed) % SAMPLE_EVERY == 0;
+	}
+
+	//
+	// exponential moving average with a weight of 1/8 on the new sample, so
+	// a call site that gets more expensive is noticed after a few runs
+	//
+	void record(std::chrono::nanoseconds sample)
+	{
+		const auto samples = samples_.load(std::memory_order_relaxed);
+		const auto average = average_ns_.load(std::memory_order_relaxed);
+
+		average_ns_.store(
+			samples == 0
+				? sample.count()
+				: average + (sample.count() - average) / 8,
+			std::memory_order_relaxed);
+
+		if(samples < MIN_SAMPLES) samples_.store(samples + 1, std::memory_order_relaxed);
+	}
+
+	std::chrono::nanoseconds average() const
+	{
+		return std::chrono::nanoseconds(average_ns_.load(std::memory_order_relaxed));
+	}
+
+private:
+
+	std::atomic<std::int64_t>  average_ns_;
+	std::atomic<std::uint32_t> samples_;
+	std::atomic<std::uint32_t> calls_;
+
+};
+
+//
+// a function that (optionally) times itself into a TaskCost
+//
+template <class Function>
+class Timed
+{
+
+public:
+
+	template <class F>
+	Timed(F && f, TaskCost * cost) :
+		f_(std::forward<F>(f)),
+		cost_(cost)
+	{
+	}
+
+	template <class... Args>
+	result_of_t<Function, Args...> operator()(Args &&... args)
+	{
+		const Stopwatch stopwatch(cost_);
+
+		return std::move(f_)(std::forward<Args>(args)...);
+	}
+
+private:
+
+	using Clock = std::chrono::steady_clock;
+
+	//
+	// records on the way out, even if f throws
+	//
+	struct Stopwatch
+	{
+		Stopwatch(TaskCost * cost) :
+			cost(cost),
+			start(cost ? Clock::now() : Clock::time_point())
+		{
+		}
+
+		~Stopwatch()
+		{
+			if(cost) cost->record(Clock::now() - start);
+		}
+
+		TaskCost *        cost;
+		Clock::time_point start;
+	};
+
+	Function   f_;
+	TaskCost * cost_;
+
+};
+
+} // namespace detail
+
+} // namespace rtw
@@ -0,0 +1,448 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <rtw/future.h>
+#include <rtw/meta.hpp>
+
+namespace rtw
+{
+
+//
+// a set of tasks with dependencies between them, run on an executor (usually a
+// ThreadPool) with each task queued as soon as the last thing it depends on
+// finishes
+//
+// the graph is built once and can be run any number of times (one run at a
+// time). running it doesn't allocate anything per task: the nodes themselves
+// are what go in the pool's queues
+//``````````````````````````````````````````````````````````````````````````````
+//	rtw::TaskGraph graph;
+//
+//	const auto fetch   = graph.add([&] { fetch_sources(); });
+//	const auto compile = graph.add([&] { compile_sources(); });
+//	const auto link    = graph.add([&] { link_objects(); });
+//
+//	graph.precede(fetch, compile);
+//	graph.precede(compile, link);
+//
+//	const auto timing = graph.run(pool).get();
+//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+//
+// if a task throws, tasks that haven't started yet are skipped and the run's
+// future gets the first exception. the graph has to outlive its runs
+//
+class TaskGraph : private meta::NoCopy
+{
+
+public:
+
+	using Clock  = std::chrono::steady_clock;
+	using NodeId = std::size_t;
+
+	//
+	// what a run's future gives you
+	//
+	struct Timing
+	{
+		//
+		// from run() to the last task finishing
+		//
+		Clock::duration wall;
+
+		//
+		// every task's run time added up
+		//
+		Clock::duration busy;
+
+		//
+		// the longest chain of dependent tasks, by how long they actually
+		// took this time. no amount of threads makes a run faster than this
+		//
+		Clock::duration     critical_path;
+		std::vector<NodeId> critical_nodes;
+	};
+
+	TaskGraph();
+
+	template <class Function>
+	NodeId add(Function && f);
+
+	//
+	// [after] doesn't start until [before] has finished
+	//
+	void precede(NodeId before, NodeId after);
+
+	std::size_t size() const { return nodes_.size(); }
+
+	//
+	// throws if the graph has a cycle or is already running
+	//
+	Future<Timing> run(detail::Executor & executor);
+
+private:
+
+	struct Node : public detail::Task
+	{
+		Node(TaskGraph * graph, NodeId id, std::function<void()> && work) :
+			graph(graph),
+			id(id),
+			work(std::move(work)),
+			num_predecessors(0),
+			pending(0)
+		{
+		}
+
+		void run() override { graph->run_node(this); }
+
+		//
+		// the executor is going away, so the run can't finish properly
+		//
+		void discard() override
+		{
+			graph->fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+			graph->run_node(this);
+		}
+
+		TaskGraph *              graph;
+		NodeId                   id;
+		std::function<void()>    work;
+		std::vector<Node *>      successors;
+		std::size_t              num_predecessors;
+		std::atomic<std::size_t> pending;
+		Clock::time_point        started;
+		Clock::time_point        finished;
+	};
+
+	//
+	// the run's future. nothing ever queues it
+	//
+	class RunState final : public detail::State<Timing>
+	{
+
+	public:
+
+		void run() override {}
+		void discard() override {}
+
+	private:
+
+		void destroy() override { delete this; }
+
+	};
+
+	void check_not_running() const;
+	void sort();
+	void run_node(Node * node);
+	void fail(std::exception_ptr error);
+	void finish();
+	Timing timing() const;
+
+	std::vector<std::unique_ptr<Node>> nodes_;
+
+	//
+	// topological order, worked out again whenever the edges change
+	//
+	std::vector<Node *> order_;
+	bool                sorted_;
+
+	//
+	// the current run
+	//
+	std::atomic<bool>        running_;
+	std::atomic<std::size_t> remaining_;
+	std::atomic<bool>        failed_;
+	std::exception_ptr       error_;
+	detail::Executor *       executor_;
+	RunState *               state_;
+	Clock::time_point        started_;
+
+	static constexpr auto ERR_TASK_GRAPH_CYCLE =
+		"a bad programmer tried to run a task graph where the tasks depend on "
+		"each other in a circle"
+		;
+
+	static constexpr auto ERR_TASK_GRAPH_RUNNING =
+		"a bad programmer tried to change or start a task graph that was "
+		"already running"
+		;
+
+};
+
+inline TaskGraph::TaskGraph() :
+	sorted_(true),
+	running_(false),
+	remaining_(0),
+	failed_(false),
+	executor_(nullptr),
+	state_(nullptr)
+{
+}
+
+template <class Function>
+auto TaskGraph::add(Function && f) -> NodeId
+{
+	check_not_running();
+
+	nodes_.emplace_back(new Node(this, nodes_.size(), std::function<void()>(std::forward<Function>(f))));
+
+	sorted_ = false;
+
+	return nodes_.size() - 1;
+}
+
+inline void TaskGraph::precede(const NodeId before, const NodeId after)
+{
+	check_not_running();
+
+	nodes_.at(before)->successors.push_back(nodes_.at(after).get());
+	nodes_[after]->num_predecessors++;
+
+	sorted_ = false;
+}
+
+inline void TaskGraph::check_not_running() const
+{
+	if(running_.load(std::memory_order_acquire))
+	{
+		throw std::runtime_error(ERR_TASK_GRAPH_RUNNING);
+	}
+}
+
+//
+// kahn's algorithm. anything left over is on a cycle
+//
+inline void TaskGraph::sort()
+{
+	if(sorted_) return;
+
+	order_.clear();
+
+	for(const auto & node : nodes_)
+	{
+		node->pending.store(node->num_predecessors, std::memory_order_relaxed);
+
+		if(node->num_predecessors == 0) order_.push_back(node.get());
+	}
+
+	for(std::size_t i = 0; i < order_.size(); i++)
+	{
+		for(const auto successor : order_[i]->successors)
+		{
+			if(successor->pending.fetch_sub(1, std::memory_order_relaxed) == 1)
+			{
+				order_.push_back(successor);
+			}
+		}
+	}
+
+	if(order_.size() != nodes_.size()) throw std::runtime_error(ERR_TASK_GRAPH_CYCLE);
+
+	sorted_ = true;
+}
+
+inline auto TaskGraph::run(detail::Executor & executor) -> Future<Timing>
+{
+	if(running_.exchange(true, std::memory_order_acq_rel))
+	{
+		throw std::runtime_error(ERR_TASK_GRAPH_RUNNING);
+	}
+
+	try
+	{
+		sort();
+	}
+	catch(...)
+	{
+		running_.store(false, std::memory_order_release);
+
+		throw;
+	}
+
+	state_ = new RunState();
+
+	Future<Timing> future(state_);
+
+	executor_ = &executor;
+	error_    = nullptr;
+	started_  = Clock::now();
+
+	failed_.store(false, std::memory_order_relaxed);
+
+	//
+	// the extra one is for the loop below, so the run can't finish (and the
+	// graph can't be started again) while it's still going through the nodes
+	//
+	remaining_.store(nodes_.size() + 1, std::memory_order_relaxed);
+
+	for(const auto & node : nodes_)
+	{
+		node->pending.store(node->num_predecessors, std::memory_order_relaxed);
+	}
+
+	for(const auto & node : nodes_)
+	{
+		if(node->num_predecessors == 0) executor.execute(detail::TaskPtr(node.get()));
+	}
+
+	if(remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) finish();
+
+	return future;
+}
+
+//
+// runs [node], then carries straight on with one of the successors it made
+// ready (queueing the rest) rather than sending them all through the queue
+//
+// a node is counted in remaining_ until it's done with its successor list, so
+// the run can't finish, and nobody can touch the graph, while any node is
+// still in here
+//
+inline void TaskGraph::run_node(Node * node)
+{
+	while(node)
+	{
+		node->started = Clock::now();
+
+		if(!failed_.load(std::memory_order_acquire))
+		{
+			try
+			{
+				node->work();
+			}
+			catch(...)
+			{
+				fail(std::current_exception());
+			}
+		}
+
+		node->finished = Clock::now();
+
+		Node * next = nullptr;
+
+		for(const auto successor : node->successors)
+		{
+			if(successor->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+
+			if(!next)
+			{
+				next = successor;
+			}
+			else if(failed_.load(std::memory_order_acquire))
+			{
+				//
+				// it's only going to be skipped, and the executor might be
+				// on its way out
+				//
+				run_node(successor);
+			}
+			else
+			{
+				executor_->execute(detail::TaskPtr(successor));
+			}
+		}
+
+		if(remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			finish();
+
+			return;
+		}
+
+		node = next;
+	}
+}
+
+inline void TaskGraph::fail(std::exception_ptr error)
+{
+	if(!failed_.exchange(true, std::memory_order_acq_rel))
+	{
+		error_ = error;
+	}
+}
+
+//
+// the last node out hands over the result. the graph is free to be run again
+// (or destroyed) as soon as the future is ready, so it's left alone after that
+//
+inline void TaskGraph::finish()
+{
+	const auto state = state_;
+
+	if(failed_.load(std::memory_order_acquire))
+	{
+		const auto error = error_;
+
+		running_.store(false, std::memory_order_release);
+
+		state->fulfil_exception(error);
+
+		return;
+	}
+
+	auto result = timing();
+
+	running_.store(false, std::memory_order_release);
+
+	state->fulfil_from([&result]() { return std::move(result); });
+}
+
+inline auto TaskGraph::timing() const -> Timing
+{
+	Timing result;
+
+	result.wall          = Clock::now() - started_;
+	result.busy          = Clock::duration::zero();
+	result.critical_path = Clock::duration::zero();
+
+	//
+	// longest path to (and through) each node, in topological order
+	//
+	std::vector<Clock::duration> longest_to(nodes_.size(), Clock::duration::zero());
+	std::vector<NodeId>          via(nodes_.size(), NodeId(-1));
+
+	auto end = NodeId(-1);
+
+	for(const auto node : order_)
+	{
+		const auto duration = node->finished - node->started;
+		const auto through  = longest_to[node->id] + duration;
+
+		result.busy += duration;
+
+		if(end == NodeId(-1) || through > result.critical_path)
+		{
+			result.critical_path = through;
+			end                  = node->id;
+		}
+
+		for(const auto successor : node->successors)
+		{
+			if(via[successor->id] == NodeId(-1) || through > longest_to[successor->id])
+			{
+				longest_to[successor->id] = through;
+				via[successor->id]        = node->id;
+			}
+		}
+	}
+
+	for(auto id = end; id != NodeId(-1); id = via[id])
+	{
+		result.critical_nodes.push_back(id);
+	}
+
+	std::reverse(result.critical_nodes.begin(), result.critical_nodes.end());
+
+	return result;
+}
+
+} // namespace rtw
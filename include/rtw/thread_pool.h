@@ -1,132 +1,2333 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <rtw/cancellation.h>
+#include <rtw/coro.h>
+#include <rtw/cpu_topology.hpp>
+#include <rtw/future.h>
+#include <rtw/meta.hpp>
+#include <rtw/mpmc_queue.h>
+#include <rtw/priority_lanes.h>
+#include <rtw/sharded_queue.h>
 #include <rtw/sync_queue.h>
+#include <rtw/task_allocator.h>
+#include <rtw/task_cost.h>
+#include <rtw/timer_wheel.h>
+#include <rtw/work_stealing_deque.h>
+
+namespace rtw
+{
+
+class ThreadPool;
+
+namespace detail
+{
+
+//
+// per worker thread state
+//
+struct Worker
+{
+	Worker(ThreadPool * pool, std::size_t index) :
+		pool(pool),
+		index(index),
+		group(0),
+		rng(std::uint32_t(index) * 2654435761u + 1),
+		turn(0),
+		running(false),
+		tasks_run(0),
+		busy_ns(0),
+		idle_ns(0),
+		queue_wait_ns(0),
+		idle_since(0)
+	{
+	}
+
+	//
+	// only the worker's own thread writes its counters, so there's no need
+	// for a locked add
+	//
+	static void bump(std::atomic<std::uint64_t> & counter, std::uint64_t amount)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	template <class Rep, class Period>
+	static void bump(std::atomic<std::uint64_t> & counter, const std::chrono::duration<Rep, Period> & amount)
+	{
+		bump(counter, std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(amount).count()));
+	}
+
+	std::uint32_t next_random()
+	{
+		//
+		// xorshift32
+		//
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+
+		return rng;
+	}
+
+	ThreadPool *             pool;
+	std::size_t              index;
+	std::size_t              group;
+
+	//
+	// the cpus this worker's thread gets pinned to. empty means it isn't
+	//
+	std::vector<int>         affinity;
+
+	std::uint32_t            rng;
+	std::uint32_t            turn;
+	std::atomic<bool>        running;
+	WorkStealingDeque<Task*> deque;
+
+	//
+	// for ThreadPool::stats(). they carry on from one thread to the next
+	// when the slot gets reused
+	//
+	std::atomic<std::uint64_t> tasks_run;
+	std::atomic<std::uint64_t> busy_ns;
+	std::atomic<std::uint64_t> idle_ns;
+	std::atomic<std::uint64_t> queue_wait_ns;
+
+	//
+	// when the worker went to sleep (steady_clock's time_since_epoch, in
+	// nanoseconds), or zero if it's awake, so stats() can count a sleep
+	// that's still going
+	//
+	std::atomic<std::int64_t>  idle_since;
+};
+
+//
+// the worker the calling thread is, or nullptr if it isn't a pool thread
+//
+inline Worker *& current_worker()
+{
+	static thread_local Worker * worker = nullptr;
+
+	return worker;
+}
+
+} // namespace detail
+
+//
+// this is based on tyler-hardin/thread_pool except i rewrote it to be more
+// terrible
+//
+class ThreadPool : public detail::Executor
+{
+
+public:
+
+	//
+	// SharedQueue: every worker pops from one SyncQueue. simple and fair but
+	// every push and pop goes through the same mutex
+	//
+	// WorkStealing: every worker has its own deque. tasks submitted from a
+	// worker go onto that worker's deque (and are run LIFO by it), tasks
+	// submitted from anywhere else go onto a shared injection queue. workers
+	// that run out of work steal from the other end of someone else's deque
+	//
+	enum class Scheduler
+	{
+		SharedQueue,
+		WorkStealing,
+	};
+
+	//
+	// High tasks run before Normal ones, which run before Low ones. to stop a
+	// flood of high priority work starving everything else, every 8th task a
+	// worker picks comes from the normal lane first and every 16th from the
+	// low lane first, if they have anything
+	//
+	enum class Priority
+	{
+		High,
+		Normal,
+		Low,
+	};
+
+	static constexpr int NUM_PRIORITIES = 3;
+
+	using Clock    = std::chrono::steady_clock;
+	using Deadline = Clock::time_point;
+
+	//
+	// if max_threads is bigger than min_threads the pool is elastic. it starts
+	// with min_threads workers and adds one (up to max_threads) whenever work
+	// has been sitting in the queues for grow_after with no idle worker to
+	// take it, or straight away when a busy worker enters a BlockingRegion.
+	// workers above min_threads that have been idle for idle_timeout exit
+	//
+	// pin_workers pins worker i to cpus[i % cpus.size()]. if cpus is empty
+	// it's one cpu per physical core, so two workers never fight over the
+	// same core's SMT siblings
+	//
+	// node_groups splits the workers into one group per NUMA node. cpus are
+	// handed out round robin across the nodes, and workers that aren't pinned
+	// to a single cpu are restricted to their node's cpus. tasks submitted
+	// with a NodeHint only run on that node's workers, and in WorkStealing
+	// mode thieves try their own node's workers before anybody else's
+	//
+	struct Options
+	{
+		Options(int num_threads = 1, Scheduler scheduler = Scheduler::SharedQueue) :
+			min_threads(num_threads),
+			max_threads(num_threads),
+			scheduler(scheduler),
+			grow_after(std::chrono::milliseconds(2)),
+			idle_timeout(std::chrono::seconds(10)),
+			timer_resolution(std::chrono::milliseconds(1)),
+			inline_threshold(0),
+			time_tasks(false),
+			ring_capacity(0),
+			queue_shards(0),
+			pin_workers(false),
+			node_groups(false)
+		{
+		}
+
+		//
+		// one pinned worker per physical core
+		//
+		static Options per_core(Scheduler scheduler = Scheduler::WorkStealing)
+		{
+			Options options(int(cpu::Topology::system().cores().size()), scheduler);
+
+			options.pin_workers = true;
+
+			return options;
+		}
+
+		int                       min_threads;
+		int                       max_threads;
+		Scheduler                 scheduler;
+		std::chrono::microseconds grow_after;
+		std::chrono::milliseconds idle_timeout;
+
+		//
+		// the tick of the timer wheel behind async_after and friends. timers
+		// fire on the first tick at or after they're due
+		//
+		std::chrono::microseconds timer_resolution;
+
+		//
+		// if this isn't zero, async() times the tasks from each call site and
+		// runs the ones that take less than this on the calling thread,
+		// handing back a future that's already satisfied. only plain async()
+		// calls count, not ones with a priority, deadline, node or delay
+		//
+		std::chrono::nanoseconds  inline_threshold;
+
+		//
+		// workers time every task they run and how long it sat in the queue
+		// first, for WorkerStats::busy and queue_wait. that's a few clock
+		// reads per task, so it's off unless you ask
+		//
+		bool                      time_tasks;
+
+		//
+		// if this isn't zero, normal tasks that would have gone in the
+		// shared (or injection) queue go in a lock-free MpmcRing with this
+		// many slots instead, and only spill into the locked queue when the
+		// ring is full. tasks that spill can run out of order with the ones
+		// in the ring
+		//
+		std::size_t               ring_capacity;
+
+		//
+		// if this isn't zero, the shared (or injection) queue for normal
+		// tasks is a ShardedQueue with this many shards instead of one
+		// SyncQueue, so submitting threads and workers don't all contend on
+		// one lock. tasks from one submitting thread still start in order,
+		// but there's no order between threads. goes behind the ring, if
+		// there is one
+		//
+		std::size_t               queue_shards;
+
+		bool                      pin_workers;
+		std::vector<int>          cpus;
+		bool                      node_groups;
+	};
+
+	//
+	// asks for a task to run on a particular NUMA node. only means anything
+	// if the pool has node_groups, and a node the pool has no running workers
+	// on (an elastic pool may have retired them) is ignored
+	//
+	struct NodeHint
+	{
+		explicit NodeHint(int node) : node(node) {}
+
+		int node;
+	};
+
+	//
+	// the caller knows the task is cheaper than sending it through the pool
+	//
+	struct Tiny {};
+
+	struct WorkerStats
+	{
+		//
+		// false for a slot an elastic pool isn't using right now
+		//
+		bool running;
+
+		std::size_t tasks_run;
+
+		//
+		// running tasks and asleep waiting for them. busy is only measured
+		// with Options::time_tasks
+		//
+		std::chrono::nanoseconds busy;
+		std::chrono::nanoseconds idle;
+
+		//
+		// how long the tasks this worker ran had been queued for, added up.
+		// also only with time_tasks
+		//
+		std::chrono::nanoseconds queue_wait;
+	};
+
+	//
+	// cheap enough to take every second or so. everything's read without
+	// stopping the workers, so it's only roughly consistent
+	//
+	struct Stats
+	{
+		//
+		// tasks waiting to run, indexed by Priority. the normal lane's count
+		// is only approximate in WorkStealing mode
+		//
+		std::size_t queued[NUM_PRIORITIES];
+
+		int threads;
+		int idle_threads;
+		int blocked_threads;
+
+		//
+		// resize events since the pool was created
+		//
+		std::size_t threads_started;
+		std::size_t threads_retired;
+
+		//
+		// async_after/async_at tasks and async_every schedules waiting for
+		// their time to come
+		//
+		std::size_t timers;
+
+		//
+		// async() calls that were run on the calling thread instead (see
+		// Options::inline_threshold and Tiny)
+		//
+		std::size_t ran_inline;
+
+		//
+		// async(CancellationToken, ...) tasks that were dropped instead of
+		// run, because their token was cancelled or had expired by the time
+		// a worker got to them
+		//
+		std::size_t cancelled;
+		std::size_t expired;
+
+		//
+		// one per worker slot (max_threads of them)
+		//
+		std::vector<WorkerStats> workers;
+
+		//
+		// the shared queue (SharedQueue mode) or the injection queue
+		// (WorkStealing mode). with a ring, size also counts what's in the
+		// ring and the rest is about the locked queue it spills into
+		//
+		SyncQueueStats queue;
+	};
+
+private:
+
+	class PeriodicTimer;
+
+public:
+
+	//
+	// a periodic schedule from async_every. the handle going away doesn't stop
+	// the schedule, cancel() does. it mustn't be called once the pool is gone
+	//
+	class Timer
+	{
+
+	public:
+
+		Timer() : timer_(nullptr) {}
+		Timer(Timer && rhs) : timer_(rhs.timer_) { rhs.timer_ = nullptr; }
+		Timer & operator=(Timer && rhs);
+		~Timer() { reset(); }
+
+		bool valid() const { return timer_ != nullptr; }
+
+		//
+		// no more runs start once this returns (one that's already going
+		// finishes). returns false if the schedule had already stopped
+		//
+		bool cancel();
+
+	private:
+
+		explicit Timer(PeriodicTimer * timer) : timer_(timer) {}
+
+		Timer(const Timer &) = delete;
+		Timer & operator=(const Timer &) = delete;
+
+		void reset();
+
+		PeriodicTimer * timer_;
+
+	friend class ThreadPool;
+
+	};
+
+	//
+	// tells the pool that the calling task is about to block (on disk I/O, a
+	// lock, whatever) so an elastic pool can bring in another worker to keep
+	// the cores busy. does nothing if the calling thread isn't a pool worker
+	//``````````````````````````````````````````````````````````````````````````
+	//	{
+	//		ThreadPool::BlockingRegion blocking;
+	//
+	//		file.read(buffer, size);
+	//	}
+	//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+	//
+	class BlockingRegion : private meta::NoCopy
+	{
+
+	public:
+
+		BlockingRegion();
+		~BlockingRegion();
+
+	private:
+
+		ThreadPool * pool_;
+
+	};
+
+	ThreadPool(int num_threads, Scheduler scheduler = Scheduler::SharedQueue);
+	ThreadPool(const Options & options);
+	~ThreadPool();
+
+	void join();
+
+	template <class Function, class... Args>
+	using FutureFor =
+		Future<
+			result_of_t<
+				typename std::decay<Function>::type,
+				typename std::decay<Args>::type...>>;
+
+	//
+	// runs f(args...) on the pool. f and args are moved (or copied) into the
+	// task once and moved into the call, so move-only arguments and results
+	// work
+	//
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> async(Function && f, Args &&... args)
+	{
+		return spawn(Placement(Priority::Normal), std::forward<Function>(f), std::forward<Args>(args)...);
+	}
+
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> async(Priority priority, Function && f, Args &&... args)
+	{
+		return spawn(Placement(priority), std::forward<Function>(f), std::forward<Args>(args)...);
+	}
+
+	//
+	// goes in the high priority lane, ordered by deadline
+	//
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> async(Deadline deadline, Function && f, Args &&... args)
+	{
+		return spawn(Placement(deadline), std::forward<Function>(f), std::forward<Args>(args)...);
+	}
+
+	//
+	// normal priority, but only run by workers on [node]
+	//
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> async(NodeHint node, Function && f, Args &&... args)
+	{
+		return spawn(Placement(node), std::forward<Function>(f), std::forward<Args>(args)...);
+	}
+
+	//
+	// normal priority, but skipped if [token] has been cancelled or has
+	// expired by the time a worker picks the task up (or already has when
+	// it's submitted). the future of a skipped task is_cancelled() and get()
+	// throws TaskCancelled. f can keep checking the token while it runs if it
+	// wants to stop early, the pool only checks before it starts
+	//
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> async(CancellationToken token, Function && f, Args &&... args)
+	{
+		using State =
+			detail::CancellableTaskState<
+				typename std::decay<Function>::type,
+				typename std::decay<Args>::type...>;
+
+		const auto cancelled = token.cancelled();
+		const auto state     = State::make_guarded(detail::CancellationGuard(std::move(token), &skipped_), std::forward<Function>(f), std::forward<Args>(args)...);
+
+		state->set_executor(this);
+
+		FutureFor<Function, Args...> future(state);
+
+		//
+		// no point queueing it just to throw it away
+		//
+		if(cancelled) state->run();
+		else submit(TaskPtr(state));
+
+		return future;
+	}
+
+	//
+	// runs f(args...) right here and gives back a satisfied future
+	//
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> async(Tiny, Function && f, Args &&... args)
+	{
+		return spawn_inline(nullptr, std::forward<Function>(f), std::forward<Args>(args)...);
+	}
+
+	template <class Range, class Function>
+	using BatchFutureFor = FutureFor<Function, decltype(*std::begin(std::declval<const Range &>()))>;
+
+	//
+	// async(f, element) for every element of [range], queued in one go: one
+	// lock for the lot and only as many wakeups as there are tasks (or
+	// sleeping workers). f and the elements are copied into each task
+	//``````````````````````````````````````````````````````````````````````````
+	//	auto sizes = pool.async_batch(paths, [](const std::string & path) { return file_size(path); });
+	//
+	//	for(auto & size : sizes) total += size.get();
+	//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+	//
+	template <class Range, class Function>
+	std::vector<BatchFutureFor<Range, Function>> async_batch(const Range & range, Function && f);
+
+	//
+	// calls f(element) on every element of [range] in place, with the range
+	// cut into a few chunks per worker instead of a task per element. the
+	// future is ready when every call has returned. if one throws, chunks
+	// that haven't started are skipped and the future gets the first
+	// exception. [range] has to outlive the future, and f has to be safe to
+	// call from several workers at once
+	//``````````````````````````````````````````````````````````````````````````
+	//	pool.async_bulk(pixels, [](Pixel & pixel) { pixel = gamma(pixel); }).get();
+	//,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,
+	//
+	template <class Range, class Function>
+	Future<void> async_bulk(Range & range, Function && f);
+
+	//
+	// like async, but the task isn't queued until [delay] has passed (or
+	// [when] has come). waiting timers live in a timer wheel, so there can be
+	// lots of them and none of them ties up a thread
+	//
+	template <class Rep, class Period, class Function, class... Args>
+	FutureFor<Function, Args...> async_after(const std::chrono::duration<Rep, Period> & delay, Function && f, Args &&... args)
+	{
+		return async_at(Clock::now() + std::chrono::duration_cast<Clock::duration>(delay), std::forward<Function>(f), std::forward<Args>(args)...);
+	}
+
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> async_at(Deadline when, Function && f, Args &&... args)
+	{
+		auto placement = Placement(Priority::Normal);
+
+		placement.not_before = when;
+
+		return spawn(placement, std::forward<Function>(f), std::forward<Args>(args)...);
+	}
+
+	//
+	// queues f() every [period], starting [period] from now. the next run is
+	// timed from when the last one was due, but isn't queued until the last
+	// one has finished, so runs never overlap and ones that would have been
+	// missed are skipped. if f throws, the schedule stops
+	//
+	template <class Rep, class Period, class Function>
+	Timer async_every(const std::chrono::duration<Rep, Period> & period, Function && f);
+
+#if defined(RTW_HAS_COROUTINES)
+
+	//
+	// co_await pool.schedule() moves the calling coroutine onto the pool (or
+	// to the back of the queue, if it's already on it). see rtw/coro.h
+	//
+	detail::ScheduleAwaiter schedule() { return detail::ScheduleAwaiter(this); }
+
+#endif
+
+	Stats stats() const;
+
+	Scheduler scheduler() const { return scheduler_; }
+
+private:
+
+	using Task    = detail::Task;
+	using TaskPtr = detail::TaskPtr;
+	using Worker  = detail::Worker;
+	using Lanes   = detail::PriorityLanes;
+
+	//
+	// where a task should go
+	//
+	struct Placement
+	{
+		Placement(Priority priority) :
+			priority(priority),
+			deadline(priority == Priority::High ? Clock::now() : Deadline()),
+			node(-1)
+		{
+		}
+
+		Placement(Deadline deadline) :
+			priority(Priority::High),
+			deadline(deadline),
+			node(-1)
+		{
+		}
+
+		Placement(NodeHint hint) :
+			priority(Priority::Normal),
+			node(hint.node)
+		{
+		}
+
+		Priority priority;
+		Deadline deadline;
+		int      node;
+
+		//
+		// goes through the timer wheel first unless this is Deadline()
+		//
+		Deadline not_before;
+
+		bool plain() const
+		{
+			return priority == Priority::Normal && node < 0 && not_before == Deadline();
+		}
+	};
+
+	using TimerWheel = detail::TimerWheel;
+
+	//
+	// something waiting in the timer wheel. when it's taken out it either
+	// hands its task to the pool (fire) or throws it away (drop), and lets go
+	// of the wheel's reference to itself
+	//
+	class TimerEntry : public TimerWheel::Node, public detail::Pooled
+	{
+
+	public:
+
+		virtual ~TimerEntry() {}
+
+		virtual void fire(ThreadPool & pool) = 0;
+		virtual void drop() = 0;
+
+	};
+
+	//
+	// a task from async_after/async_at
+	//
+	class DelayedTask : public TimerEntry
+	{
+
+	public:
+
+		DelayedTask(TaskPtr task, const Placement & placement) :
+			task_(std::move(task)),
+			placement_(placement)
+		{
+		}
+
+		void fire(ThreadPool & pool) override
+		{
+			pool.submit(std::move(task_), placement_);
+
+			delete this;
+		}
+
+		void drop() override { delete this; }
+
+	private:
+
+		TaskPtr   task_;
+		Placement placement_;
+
+	};
+
+	//
+	// an async_every schedule. it goes back and forth between the timer wheel
+	// and the pool's queues, holding one reference for whichever it's in plus
+	// one for the Timer handle
+	//
+	class PeriodicTimer : public TimerEntry, public Task
+	{
+
+	public:
+
+		PeriodicTimer(ThreadPool * pool, Clock::duration period) :
+			pool_(pool),
+			period_(period),
+			due_(Clock::now() + period),
+			refs_(2),
+			stopped_(false)
+		{
+		}
+
+		void fire(ThreadPool & pool) override { pool.submit(TaskPtr(this)); }
+		void drop() override { release(); }
+
+		void run() override;
+		void discard() override { release(); }
+
+		void release()
+		{
+			if(refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+		}
+
+	protected:
+
+		virtual void call() = 0;
+
+	private:
+
+		ThreadPool *      pool_;
+		Clock::duration   period_;
+		Deadline          due_;
+		std::atomic<int>  refs_;
+
+		//
+		// set under the pool's timer_mutex_
+		//
+		std::atomic<bool> stopped_;
+
+	friend class ThreadPool;
+
+	};
+
+	template <class Function>
+	class PeriodicCall : public PeriodicTimer
+	{
+
+	public:
+
+		template <class F>
+		PeriodicCall(ThreadPool * pool, Clock::duration period, F && f) :
+			PeriodicTimer(pool, period),
+			f_(std::forward<F>(f))
+		{
+		}
+
+	private:
+
+		void call() override { f_(); }
+
+		Function f_;
+
+	};
+
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> spawn(const Placement & placement, Function && f, Args &&... args)
+	{
+		if(options_.inline_threshold.count() > 0 && placement.plain())
+		{
+			return spawn_adaptive(std::forward<Function>(f), std::forward<Args>(args)...);
+		}
+
+		using State =
+			detail::TaskState<
+				typename std::decay<Function>::type,
+				typename std::decay<Args>::type...>;
+
+		//
+		// the state starts with one reference for the queue and one for the
+		// future
+		//
+		const auto state = State::make(std::forward<Function>(f), std::forward<Args>(args)...);
+
+		state->set_executor(this);
+
+		FutureFor<Function, Args...> future(state);
+
+		submit(TaskPtr(state), placement);
+
+		return future;
+	}
+
+	//
+	// runs cheap call sites inline, queues the rest, and times both so it
+	// notices when a call site changes its mind
+	//
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> spawn_adaptive(Function && f, Args &&... args)
+	{
+		using Timed = detail::Timed<typename std::decay<Function>::type>;
+
+		using State =
+			detail::TaskState<
+				Timed,
+				typename std::decay<Args>::type...>;
+
+		auto & cost =
+			detail::TaskCost::of<
+				typename std::decay<Function>::type,
+				typename std::decay<Args>::type...>();
+
+		if(cost.cheaper_than(options_.inline_threshold))
+		{
+			return spawn_inline(cost.should_sample() ? &cost : nullptr, std::forward<Function>(f), std::forward<Args>(args)...);
+		}
+
+		const auto state = State::make(Timed(std::forward<Function>(f), &cost), std::forward<Args>(args)...);
+
+		state->set_executor(this);
+
+		FutureFor<Function, Args...> future(state);
+
+		submit(TaskPtr(state));
+
+		return future;
+	}
+
+	template <class Function, class... Args>
+	FutureFor<Function, Args...> spawn_inline(detail::TaskCost * cost, Function && f, Args &&... args)
+	{
+		using Timed = detail::Timed<typename std::decay<Function>::type>;
+
+		using State =
+			detail::TaskState<
+				Timed,
+				typename std::decay<Args>::type...>;
+
+		const auto state = State::make(Timed(std::forward<Function>(f), cost), std::forward<Args>(args)...);
+
+		state->set_executor(this);
+
+		FutureFor<Function, Args...> future(state);
+
+		ran_inline_.fetch_add(1, std::memory_order_relaxed);
+
+		state->run();
+
+		return future;
+	}
+
+	void submit(TaskPtr task, const Placement & placement = Placement(Priority::Normal));
+	void submit_batch(std::vector<TaskPtr> & tasks);
+
+	//
+	// an async_bulk call. it's the state behind the returned future and owns
+	// the chunks that go through the queues. the last chunk to finish fulfils
+	// it, which also drops the chunks' (producer's) reference
+	//
+	template <class Iterator, class Function>
+	class BulkRun final : public detail::State<void>
+	{
+
+	public:
+
+		struct Chunk final : public Task
+		{
+			Chunk(BulkRun * bulk, Iterator first, Iterator last) :
+				bulk(bulk),
+				first(first),
+				last(last)
+			{
+			}
+
+			void run() override { bulk->run_chunk(*this); }
+
+			//
+			// the pool is going away, so the call can't finish properly
+			//
+			void discard() override
+			{
+				bulk->fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+				bulk->run_chunk(*this);
+			}
+
+			BulkRun * bulk;
+			Iterator  first;
+			Iterator  last;
+		};
+
+		template <class F>
+		BulkRun(F && f, std::size_t num_chunks) :
+			f_(std::forward<F>(f)),
+			remaining_(num_chunks),
+			failed_(false)
+		{
+			chunks_.reserve(num_chunks);
+		}
+
+		void add_chunk(Iterator first, Iterator last) { chunks_.emplace_back(this, first, last); }
+
+		std::vector<Chunk> & chunks() { return chunks_; }
+
+		//
+		// nothing ever queues the state itself
+		//
+		void run() override {}
+		void discard() override {}
+
+	private:
+
+		void run_chunk(Chunk & chunk);
+		void fail(std::exception_ptr error);
+
+		void destroy() override { delete this; }
+
+		Function                 f_;
+		std::vector<Chunk>       chunks_;
+		std::atomic<std::size_t> remaining_;
+		std::atomic<bool>        failed_;
+		std::exception_ptr       error_;
+
+	};
+
+	void add_timer(TimerEntry * entry, Deadline when);
+	void rearm(PeriodicTimer * timer, bool stop);
+	bool cancel(PeriodicTimer * timer);
+	void timer_func();
+	void stop_timers();
+	void execute(TaskPtr task) override { submit(std::move(task)); }
+	bool run_pending_task() override;
+	void thread_func(Worker * worker);
+	void run_timed(Worker * worker, Task * task);
+	static void s_thread_func(ThreadPool * pool, Worker * worker);
+
+	using TaskQueue    = SyncQueue<TaskPtr>;
+	using TaskQueuePtr = std::unique_ptr<TaskQueue>;
+	using ShardedTasks = ShardedQueue<TaskPtr>;
+	using WorkerPtr    = std::unique_ptr<Worker>;
+
+	//
+	// the workers on one NUMA node (or all of them, without node_groups)
+	//
+	struct Group
+	{
+		Group(int node) :
+			node(node),
+			live(0),
+			sleepers(0)
+		{
+		}
+
+		int node;
+
+		//
+		// how many of this group's workers are running. NodeHint tasks only
+		// come here while it's more than zero
+		//
+		std::atomic<int> live;
+
+		//
+		// NodeHint tasks for this node
+		//
+		TaskQueue tasks;
+
+		//
+		// this group's share of sleepers_, and where they sleep. both go with
+		// idle_mutex_
+		//
+		std::condition_variable idle_cond;
+		std::atomic<int>        sleepers;
+	};
+
+	using GroupPtr = std::unique_ptr<Group>;
+
+	void place_workers();
+	Group * group_for_node(int node) const;
+	void leave_group(Group & group);
+	void rehome_hinted(Group & group);
+
+	bool elastic() const { return options_.max_threads > options_.min_threads; }
+	void start_worker(Worker * worker);
+	bool grow();
+	bool try_retire();
+	bool has_queued_work() const;
+	void monitor_func();
+	void under_pressure();
+
+	Task * find_task(Worker * worker);
+	Task * find_normal_task(Worker * worker);
+	Task * steal_task(Worker * worker);
+	Task * wait_for_task(Worker * worker);
+	bool wake_one();
+	std::size_t wake_some(std::size_t count);
+	bool wake_group(Group & group);
+
+	Options                 options_;
+	Scheduler               scheduler_;
+
+	//
+	// in SharedQueue mode this is the normal lane. in WorkStealing mode it's
+	// the injection queue for normal tasks submitted from outside the pool
+	//
+	TaskQueuePtr            tasks_;
+	Lanes                   lanes_;
+
+	//
+	// with Options::ring_capacity, the lock-free front of tasks_
+	//
+	std::unique_ptr<MpmcRing<TaskPtr>> ring_;
+
+	//
+	// with Options::queue_shards, takes over from tasks_, which is then
+	// left empty
+	//
+	std::unique_ptr<ShardedTasks> sharded_;
+
+	//
+	// one slot per potential worker (max_threads of them). slots of retired
+	// workers get reused when the pool grows again
+	//
+	std::vector<WorkerPtr>   workers_;
+	std::vector<GroupPtr>    groups_;
+	std::vector<std::thread> threads_;
+	std::mutex               resize_mutex_;
+	std::atomic<int>         num_threads_;
+	std::atomic<int>         blocked_;
+	std::atomic<std::size_t> threads_started_;
+	std::atomic<std::size_t> threads_retired_;
+	std::atomic<std::size_t> ran_inline_;
+	detail::SkipCounters     skipped_;
+
+	//
+	// elastic mode only. the monitor sleeps until a submitter finds nobody
+	// idle to wake, then checks every grow_after whether the work is still
+	// stuck
+	//
+	std::thread              monitor_;
+	std::mutex               monitor_mutex_;
+	std::condition_variable  monitor_cond_;
+	std::atomic<bool>        pressure_;
+
+	//
+	// async_after/async_at/async_every. the timer thread only gets started
+	// the first time somebody uses them. timer_wake_ is when it's next due to
+	// wake up, so inserting something later than that doesn't have to wake it
+	//
+	// num_timers_ follows timers_.size() (set under timer_mutex_) so stats()
+	// can read it without the lock
+	//
+	TimerWheel               timers_;
+	std::thread              timer_thread_;
+	mutable std::mutex       timer_mutex_;
+	std::condition_variable  timer_cond_;
+	Deadline                 timer_wake_;
+	bool                     timers_dying_;
+	std::atomic<std::size_t> num_timers_;
+
+	//
+	// idle workers sleep on their group's idle_cond. submitters only touch
+	// idle_mutex_ if sleepers_ says someone is actually asleep
+	//
+	std::mutex              idle_mutex_;
+	std::atomic<int>        sleepers_;
+	std::size_t             next_wake_;
+	bool                    dying_;
+
+};
+
+inline ThreadPool::ThreadPool(int num_threads, Scheduler scheduler) :
+	ThreadPool(Options(num_threads, scheduler))
+{
+}
+
+inline ThreadPool::ThreadPool(const Options & options) :
+	options_(options),
+	scheduler_(options.scheduler),
+	tasks_(TaskQueuePtr(new TaskQueue())),
+	ring_(options.ring_capacity > 0 ? new MpmcRing<TaskPtr>(options.ring_capacity) : nullptr),
+	sharded_(options.queue_shards > 0 ? new ShardedTasks(options.queue_shards) : nullptr),
+	threads_(std::size_t(std::max(options.max_threads, options.min_threads))),
+	num_threads_(0),
+	blocked_(0),
+	threads_started_(0),
+	threads_retired_(0),
+	ran_inline_(0),
+	pressure_(false),
+	timers_(options.timer_resolution),
+	timer_wake_(Deadline::max()),
+	timers_dying_(false),
+	num_timers_(0),
+	sleepers_(0),
+	next_wake_(0),
+	dying_(false)
+{
+	options_.max_threads = std::max(options_.max_threads, options_.min_threads);
+
+	for(int i = 0; i < options_.max_threads; i++)
+	{
+		workers_.emplace_back(new Worker(this, std::size_t(i)));
+	}
+
+	place_workers();
+
+	{
+		std::lock_guard<std::mutex> lock(resize_mutex_);
+
+		for(int i = 0; i < options_.min_threads; i++)
+		{
+			start_worker(workers_[std::size_t(i)].get());
+		}
+	}
+
+	if(elastic())
+	{
+		monitor_ = std::thread(&ThreadPool::monitor_func, this);
+	}
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	stop_timers();
+
+	{
+		std::lock_guard<std::mutex> lock(idle_mutex_);
+
+		dying_ = true;
+
+		for(auto & group : groups_) group->idle_cond.notify_all();
+	}
+
+	if(monitor_.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(monitor_mutex_);
+
+			monitor_cond_.notify_all();
+		}
+
+		monitor_.join();
+	}
+
+	tasks_->kill();
+
+	if(sharded_) sharded_->kill();
+
+	for(auto & group : groups_) group->tasks.kill();
+
+	join();
+
+	//
+	// throw away anything that never got run
+	//
+	for(auto & worker : workers_)
+	{
+		Task * task;
+
+		while(worker->deque.pop(&task)) task->discard();
+	}
+
+	if(ring_)
+	{
+		TaskPtr task;
+
+		while(ring_->try_pop(task)) task.reset();
+	}
+
+	lanes_.discard_all();
+}
+
+//
+// wait for all tasks to finish
+//
+inline void ThreadPool::join()
+{
+	//
+	// once the pool is dying grow() won't start anything new, so this just
+	// waits for a worker that's already being started
+	//
+	{
+		std::lock_guard<std::mutex> lock(resize_mutex_);
+	}
+
+	for(auto & t : threads_)
+	{
+		if(t.joinable()) t.join();
+	}
+}
+
+//
+// works out which group each worker slot belongs to and which cpus it's
+// pinned to. a slot keeps its placement when it's reused by an elastic pool
+//
+inline void ThreadPool::place_workers()
+{
+	if(!options_.pin_workers && !options_.node_groups)
+	{
+		groups_.emplace_back(new Group(-1));
+
+		return;
+	}
+
+	const auto & topology = cpu::Topology::system();
+
+	auto cpus = options_.cpus.empty() ? topology.cores() : options_.cpus;
+
+	//
+	// deal the cpus out one node at a time so a pool smaller than the machine
+	// still spreads across every node
+	//
+	std::vector<int> nodes;
+	std::vector<std::vector<int>> by_node;
+
+	for(const auto cpu : cpus)
+	{
+		const auto node = std::max(0, topology.node_of(cpu));
+
+		auto it = std::find(nodes.begin(), nodes.end(), node);
+
+		if(it == nodes.end())
+		{
+			nodes.push_back(node);
+			by_node.emplace_back();
+
+			it = nodes.end() - 1;
+		}
+
+		by_node[std::size_t(it - nodes.begin())].push_back(cpu);
+	}
+
+	std::vector<int> order;
+
+	for(std::size_t i = 0; order.size() < cpus.size(); i++)
+	{
+		for(const auto & node_cpus : by_node)
+		{
+			if(i < node_cpus.size()) order.push_back(node_cpus[i]);
+		}
+	}
+
+	if(order.empty() || !options_.node_groups)
+	{
+		groups_.emplace_back(new Group(-1));
+	}
+
+	if(order.empty()) return;
+
+	//
+	// only nodes that actually get a worker slot get a group, so a pool
+	// smaller than the number of nodes doesn't end up with groups nobody
+	// could ever run
+	//
+	std::vector<int> used;
+
+	for(auto & worker : workers_)
+	{
+		const auto cpu  = order[worker->index % order.size()];
+		const auto node = std::max(0, topology.node_of(cpu));
+
+		if(options_.node_groups)
+		{
+			auto it = std::find(used.begin(), used.end(), node);
+
+			if(it == used.end())
+			{
+				used.push_back(node);
+				groups_.emplace_back(new Group(node));
+
+				it = used.end() - 1;
+			}
+
+			worker->group = std::size_t(it - used.begin());
+		}
+
+		if(options_.pin_workers)
+		{
+			worker->affinity.assign(1, cpu);
+		}
+		else
+		{
+			worker->affinity = topology.cpus_of_node(node);
+		}
+	}
+}
+
+//
+// nullptr unless the pool has node_groups and a running worker on [node]
+//
+inline auto ThreadPool::group_for_node(const int node) const -> Group *
+{
+	if(!options_.node_groups) return nullptr;
+
+	for(const auto & group : groups_)
+	{
+		if(group->node == node) return group->live.load(std::memory_order_relaxed) > 0 ? group.get() : nullptr;
+	}
+
+	return nullptr;
+}
+
+//
+// a worker that's retiring. if it was the last one in its group, whatever
+// was hinted at the group goes back to the shared queue
+//
+// submit() bumps the group's queue before it looks at live, and we drop live
+// before we look at the queue, so either it sees there's nobody left or we
+// see its task
+//
+inline void ThreadPool::leave_group(Group & group)
+{
+	if(group.live.fetch_sub(1, std::memory_order_seq_cst) == 1)
+	{
+		rehome_hinted(group);
+	}
+}
+
+inline void ThreadPool::rehome_hinted(Group & group)
+{
+	for(;;)
+	{
+		auto hinted = group.tasks.try_pop();
+
+		if(!hinted) return;
+
+		submit(std::move(hinted.get()), Placement(Priority::Normal));
+	}
+}
+
+//
+// resize_mutex_ has to be locked
+//
+inline void ThreadPool::start_worker(Worker * const worker)
+{
+	auto & thread = threads_[worker->index];
+
+	//
+	// the last worker in this slot retired, it's on its way out if it
+	// isn't gone already
+	//
+	if(thread.joinable()) thread.join();
+
+	worker->running.store(true, std::memory_order_relaxed);
+
+	groups_[worker->group]->live.fetch_add(1, std::memory_order_seq_cst);
+
+	num_threads_.fetch_add(1, std::memory_order_relaxed);
+	threads_started_.fetch_add(1, std::memory_order_relaxed);
+
+	thread = std::thread(&s_thread_func, this, worker);
+}
+
+//
+// starts another worker if there's room. returns false if there isn't
+//
+inline bool ThreadPool::grow()
+{
+	std::lock_guard<std::mutex> lock(resize_mutex_);
+
+	{
+		std::lock_guard<std::mutex> idle_lock(idle_mutex_);
+
+		if(dying_) return false;
+	}
+
+	if(num_threads_.load(std::memory_order_relaxed) >= options_.max_threads) return false;
+
+	//
+	// a slot in a group with hinted work waiting first, since only that
+	// group's workers can take it
+	//
+	Worker * spare = nullptr;
+
+	for(auto & worker : workers_)
+	{
+		if(worker->running.load(std::memory_order_acquire)) continue;
+
+		if(groups_[worker->group]->tasks.size() > 0)
+		{
+			spare = worker.get();
+
+			break;
+		}
+
+		if(!spare) spare = worker.get();
+	}
+
+	if(!spare) return false;
+
+	start_worker(spare);
+
+	return true;
+}
+
+//
+// called by an idle worker whose idle_timeout ran out. returns true if it
+// should exit
+//
+inline bool ThreadPool::try_retire()
+{
+	auto threads = num_threads_.load(std::memory_order_relaxed);
+
+	while(threads > options_.min_threads)
+	{
+		if(num_threads_.compare_exchange_weak(threads, threads - 1, std::memory_order_relaxed))
+		{
+			threads_retired_.fetch_add(1, std::memory_order_relaxed);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+inline bool ThreadPool::has_queued_work() const
+{
+	if(!lanes_.empty() || tasks_->size() > 0) return true;
+
+	if(ring_ && ring_->size() > 0) return true;
+
+	if(sharded_ && sharded_->size() > 0) return true;
+
+	for(const auto & group : groups_)
+	{
+		if(group->tasks.size() > 0) return true;
+	}
+
+	for(const auto & worker : workers_)
+	{
+		if(!worker->deque.empty()) return true;
+	}
+
+	return false;
+}
+
+//
+// a submitter couldn't find an idle worker, or a worker is about to block
+//
+inline void ThreadPool::under_pressure()
+{
+	if(pressure_.load(std::memory_order_relaxed)) return;
+	if(pressure_.exchange(true, std::memory_order_acq_rel)) return;
+
+	std::lock_guard<std::mutex> lock(monitor_mutex_);
+
+	monitor_cond_.notify_one();
+}
+
+inline void ThreadPool::monitor_func()
+{
+	std::unique_lock<std::mutex> lock(monitor_mutex_);
+
+	for(;;)
+	{
+		if(pressure_.load(std::memory_order_acquire))
+		{
+			monitor_cond_.wait_for(lock, options_.grow_after);
+		}
+		else
+		{
+			monitor_cond_.wait(lock);
+		}
+
+		{
+			std::lock_guard<std::mutex> idle_lock(idle_mutex_);
+
+			if(dying_) return;
+		}
+
+		if(!pressure_.load(std::memory_order_acquire)) continue;
+
+		const auto stuck =
+			sleepers_.load(std::memory_order_relaxed) == 0 &&
+			has_queued_work();
+
+		if(!stuck || !grow())
+		{
+			pressure_.store(false, std::memory_order_release);
+		}
+	}
+}
+
+inline ThreadPool::BlockingRegion::BlockingRegion() :
+	pool_(nullptr)
+{
+	const auto worker = detail::current_worker();
+
+	if(!worker) return;
+
+	pool_ = worker->pool;
+
+	pool_->blocked_.fetch_add(1, std::memory_order_relaxed);
+
+	//
+	// no point waiting for grow_after, we know this worker is going to be
+	// stuck for a while
+	//
+	if(pool_->elastic() &&
+		pool_->sleepers_.load(std::memory_order_relaxed) == 0 &&
+		pool_->has_queued_work())
+	{
+		pool_->grow();
+	}
+}
+
+inline ThreadPool::BlockingRegion::~BlockingRegion()
+{
+	if(pool_) pool_->blocked_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+inline void ThreadPool::submit(TaskPtr task, const Placement & placement)
+{
+	if(placement.not_before != Deadline())
+	{
+		auto when_due = placement;
+
+		when_due.not_before = Deadline();
+
+		add_timer(new DelayedTask(std::move(task), when_due), placement.not_before);
+
+		return;
+	}
+
+	if(options_.time_tasks) task->queued_at = Clock::now();
+
+	const auto worker = detail::current_worker();
+
+	if(placement.node >= 0)
+	{
+		const auto group = group_for_node(placement.node);
+
+		if(group)
+		{
+			group->tasks.push(std::move(task));
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			//
+			// the group's last worker retired under us (see leave_group)
+			//
+			if(group->live.load(std::memory_order_relaxed) == 0)
+			{
+				rehome_hinted(*group);
+
+				return;
+			}
+
+			if(!wake_group(*group) && elastic())
+			{
+				under_pressure();
+			}
+
+			return;
+		}
+	}
+
+	if(placement.priority == Priority::High)
+	{
+		lanes_.push_high(task.release(), placement.deadline);
+	}
+	else if(placement.priority == Priority::Low)
+	{
+		lanes_.push_low(task.release());
+	}
+	else if(scheduler_ == Scheduler::WorkStealing && worker && worker->pool == this)
+	{
+		worker->deque.push(task.release());
+	}
+	else if(!ring_ || !ring_->try_push(std::move(task)))
+	{
+		if(sharded_)
+		{
+			sharded_->push(std::move(task));
+		}
+		else
+		{
+			tasks_->push(std::move(task));
+		}
+	}
+
+	if(!wake_one() && elastic())
+	{
+		under_pressure();
+	}
+}
+
+//
+// normal priority tasks with no node, all queued in one go. like submit, from
+// a WorkStealing worker they go on its own deque for the others to steal
+//
+inline void ThreadPool::submit_batch(std::vector<TaskPtr> & tasks)
+{
+	const auto count = tasks.size();
+
+	if(count == 0) return;
+
+	if(options_.time_tasks)
+	{
+		const auto now = Clock::now();
+
+		for(auto & task : tasks) task->queued_at = now;
+	}
+
+	const auto worker = detail::current_worker();
+
+	if(scheduler_ == Scheduler::WorkStealing && worker && worker->pool == this)
+	{
+		for(auto & task : tasks) worker->deque.push(task.release());
+	}
+	else
+	{
+		auto spilled = tasks.begin();
+
+		if(ring_)
+		{
+			while(spilled != tasks.end() && ring_->try_push(std::move(*spilled))) ++spilled;
+		}
+
+		if(sharded_)
+		{
+			sharded_->push_range(spilled, tasks.end());
+		}
+		else
+		{
+			tasks_->push_range(spilled, tasks.end());
+		}
+	}
+
+	tasks.clear();
+
+	//
+	// in an elastic pool, more tasks than sleepers is a hint that it might
+	// want to grow
+	//
+	if(wake_some(count) < count && elastic())
+	{
+		under_pressure();
+	}
+}
+
+inline ThreadPool::Stats ThreadPool::stats() const
+{
+	Stats stats;
+
+	stats.queue = sharded_ ? sharded_->stats() : tasks_->stats();
+
+	if(ring_) stats.queue.size += ring_->size();
+
+	auto normal = stats.queue.size;
+
+	if(sharded_) normal += tasks_->stats().size;
+
+	for(const auto & group : groups_)
+	{
+		normal += group->tasks.stats().size;
+	}
+
+	for(const auto & worker : workers_)
+	{
+		normal += worker->deque.size();
+	}
+
+	stats.queued[int(Priority::High)]   = lanes_.size(Lanes::HIGH);
+	stats.queued[int(Priority::Normal)] = normal;
+	stats.queued[int(Priority::Low)]    = lanes_.size(Lanes::LOW);
+
+	stats.threads         = num_threads_.load(std::memory_order_relaxed);
+	stats.idle_threads    = sleepers_.load(std::memory_order_relaxed);
+	stats.blocked_threads = blocked_.load(std::memory_order_relaxed);
+	stats.threads_started = threads_started_.load(std::memory_order_relaxed);
+	stats.threads_retired = threads_retired_.load(std::memory_order_relaxed);
+	stats.ran_inline      = ran_inline_.load(std::memory_order_relaxed);
+	stats.cancelled       = skipped_.cancelled.load(std::memory_order_relaxed);
+	stats.expired         = skipped_.expired.load(std::memory_order_relaxed);
+
+	stats.timers          = num_timers_.load(std::memory_order_relaxed);
+
+	stats.workers.reserve(workers_.size());
+
+	const auto now = std::chrono::nanoseconds(Clock::now().time_since_epoch()).count();
+
+	for(const auto & worker : workers_)
+	{
+		WorkerStats worker_stats;
+
+		worker_stats.running    = worker->running.load(std::memory_order_relaxed);
+		worker_stats.tasks_run  = std::size_t(worker->tasks_run.load(std::memory_order_relaxed));
+		worker_stats.busy       = std::chrono::nanoseconds(worker->busy_ns.load(std::memory_order_relaxed));
+		worker_stats.idle       = std::chrono::nanoseconds(worker->idle_ns.load(std::memory_order_relaxed));
+		worker_stats.queue_wait = std::chrono::nanoseconds(worker->queue_wait_ns.load(std::memory_order_relaxed));
+
+		const auto idle_since = worker->idle_since.load(std::memory_order_relaxed);
+
+		if(idle_since != 0 && idle_since < now) worker_stats.idle += std::chrono::nanoseconds(now - idle_since);
+
+		stats.workers.push_back(worker_stats);
+	}
+
+	return stats;
+}
+
+inline void ThreadPool::thread_func(Worker * const worker)
+{
+	detail::current_worker()   = worker;
+	detail::current_executor() = this;
+
+	if(!worker->affinity.empty()) cpu::pin_current_thread(worker->affinity);
+
+	for(;;)
+	{
+		auto task = find_task(worker);
+
+		if(!task)
+		{
+			const auto idle_since = Clock::now();
+
+			worker->idle_since.store(std::chrono::nanoseconds(idle_since.time_since_epoch()).count(), std::memory_order_relaxed);
+
+			task = wait_for_task(worker);
+
+			worker->idle_since.store(0, std::memory_order_relaxed);
+
+			Worker::bump(worker->idle_ns, Clock::now() - idle_since);
+
+			if(!task) break;
+		}
+
+		if(options_.time_tasks) run_timed(worker, task);
+		else task->run();
+
+		Worker::bump(worker->tasks_run, 1);
+	}
 
-#include "future_util.h"
+	worker->running.store(false, std::memory_order_release);
+}
 
-namespace rtw
+//
+// called by a worker that's waiting on a future
+//
+inline bool ThreadPool::run_pending_task()
+{
+	const auto worker = detail::current_worker();
+
+	if(!worker || worker->pool != this) return false;
+
+	const auto task = find_task(worker);
+
+	if(!task) return false;
+
+	//
+	// no timing here, the task that's waiting is already being timed
+	//
+	task->run();
+
+	Worker::bump(worker->tasks_run, 1);
+
+	return true;
+}
+
+inline void ThreadPool::run_timed(Worker * const worker, Task * const task)
+{
+	const auto start = Clock::now();
+
+	if(task->queued_at != Deadline()) Worker::bump(worker->queue_wait_ns, start - task->queued_at);
+
+	task->run();
+
+	Worker::bump(worker->busy_ns, Clock::now() - start);
+}
+
+inline void ThreadPool::s_thread_func(ThreadPool * const pool, Worker * const worker)
 {
+	pool->thread_func(worker);
+}
 
 //
-// this is based on tyler-hardin/thread_pool except i rewrote it to be more
-// terrible
+// high lane, then normal, then low, except every so often a lower lane gets to
+// go first so it can't be starved
 //
-class ThreadPool
+inline auto ThreadPool::find_task(Worker * const worker) -> Task *
 {
+	if(lanes_.empty()) return find_normal_task(worker);
 
-public:
+	const auto turn = worker->turn++;
 
-	ThreadPool(int num_threads);
-	~ThreadPool();
+	Task * task = nullptr;
 
-	void join();
+	if(turn % 16 == 15)
+	{
+		task = lanes_.pop(Lanes::LOW);
+	}
+	else if(turn % 8 != 7)
+	{
+		task = lanes_.pop(Lanes::HIGH);
+	}
 
-	template <class Function, class... Args>
-	std::future<typename std::result_of<Function(Args...)>::type>
-	async(Function f, Args ... args)
+	if(!task) task = find_normal_task(worker);
+	if(!task) task = lanes_.pop_any(Lanes::HIGH);
+
+	return task;
+}
+
+//
+// SharedQueue: the queue
+//
+// WorkStealing: own deque first (newest first, it's the hottest in cache),
+// then the injection queue, then everybody else's deques
+//
+// with node_groups, tasks hinted at this worker's node come before the shared
+// queue
+//
+inline auto ThreadPool::find_normal_task(Worker * const worker) -> Task *
+{
+	Task * task;
+
+	if(scheduler_ == Scheduler::WorkStealing && worker->deque.pop(&task)) return task;
+
+	if(options_.node_groups)
 	{
-		using Result = typename std::result_of<Function(Args...)>::type;
+		auto hinted = groups_[worker->group]->tasks.try_pop();
 
-		const auto ready = new std::atomic<bool>(false);
-		const auto p     = new std::promise<Result>();
+		if(hinted) return hinted.get().release();
+	}
 
-		//
-		// this is the function we actually push onto the queue
-		//
-		// it calls the client's function, stores the result in the promise
-		// and notifies the result wrapper that the result is ready
-		//
-		auto task_wrapper =
-			[p, ready](Function f, Args ... args)
-			{
-				p->set_value(f(args...));
+	if(ring_)
+	{
+		TaskPtr queued;
 
-				ready->store(true);
-			};
+		if(ring_->try_pop(queued)) return queued.release();
+	}
 
-		//
-		// this guy waits for a notification that the client's function has been
-		// run and the result is ready, then returns the result
-		//
-		auto result_wrapper =
-			[p, ready]() -> Result
+	auto queued = sharded_ ? sharded_->try_pop() : tasks_->try_pop();
+
+	if(queued) return queued.get().release();
+
+	if(scheduler_ == Scheduler::WorkStealing) return steal_task(worker);
+
+	return nullptr;
+}
+
+inline auto ThreadPool::steal_task(Worker * const worker) -> Task *
+{
+	const auto num_workers = workers_.size();
+
+	if(num_workers < 2) return nullptr;
+
+	//
+	// start at a random victim so thieves don't all pile onto the same one.
+	// with more than one group, the first pass only looks at this worker's
+	// own node
+	//
+	const auto start  = worker->next_random() % num_workers;
+	const auto passes = groups_.size() > 1 ? 2 : 1;
+
+	Task * task;
+
+	for(int pass = 0; pass < passes; pass++)
+	{
+		for(std::size_t i = 0; i < num_workers; i++)
+		{
+			const auto & victim = workers_[(start + i) % num_workers];
+
+			if(victim.get() == worker) continue;
+
+			if(passes > 1 && (victim->group == worker->group) != (pass == 0)) continue;
+
+			if(victim->deque.steal(&task)) return task;
+		}
+	}
+
+	return nullptr;
+}
+
+//
+// goes to sleep until there's something to do. returns nullptr if the pool is
+// dying or if this worker has been idle long enough to retire
+//
+// sleepers_ is bumped before the last look for work, and submitters bump their
+// queue before looking at sleepers_, so either we see their task or they see
+// us and wake us up
+//
+inline auto ThreadPool::wait_for_task(Worker * const worker) -> Task *
+{
+	auto & group = *groups_[worker->group];
+
+	std::unique_lock<std::mutex> lock(idle_mutex_);
+
+	auto timed_out = false;
+
+	for(;;)
+	{
+		if(dying_) return nullptr;
+
+		group.sleepers.fetch_add(1, std::memory_order_relaxed);
+		sleepers_.fetch_add(1, std::memory_order_seq_cst);
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		const auto task = find_task(worker);
+
+		if(task || (timed_out && try_retire()))
+		{
+			sleepers_.fetch_sub(1, std::memory_order_relaxed);
+			group.sleepers.fetch_sub(1, std::memory_order_relaxed);
+
+			if(!task)
 			{
-				while(!ready->load()) std::this_thread::yield();
+				lock.unlock();
+
+				leave_group(group);
+			}
+
+			return task;
+		}
+
+		if(elastic())
+		{
+			timed_out = group.idle_cond.wait_for(lock, options_.idle_timeout) == std::cv_status::timeout;
+		}
+		else
+		{
+			group.idle_cond.wait(lock);
+		}
+
+		sleepers_.fetch_sub(1, std::memory_order_relaxed);
+		group.sleepers.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+//
+// returns false if there was nobody asleep to wake
+//
+inline bool ThreadPool::wake_one()
+{
+	return wake_some(1) > 0;
+}
+
+//
+// wakes up to [count] sleepers and returns how many it woke
+//
+inline std::size_t ThreadPool::wake_some(const std::size_t count)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
 
-				auto result = p->get_future().get();
+	if(sleepers_.load(std::memory_order_relaxed) == 0) return 0;
 
-				delete p;
-				delete ready;
+	std::lock_guard<std::mutex> lock(idle_mutex_);
 
-				return result;
-			};
+	//
+	// the group sleeper counts only change under idle_mutex_, so they're
+	// exact here. go round the groups so one node doesn't get all the work
+	//
+	const auto num_groups = groups_.size();
+	const auto start      = next_wake_++;
 
-		tasks_->push(
-				std::async(
-					std::launch::deferred,
-					task_wrapper,
-					f,
-					args...));
+	std::size_t woken = 0;
 
+	for(std::size_t i = 0; i < num_groups && woken < count; i++)
+	{
+		auto & group = *groups_[(start + i) % num_groups];
+
+		const auto sleepers = std::size_t(group.sleepers.load(std::memory_order_relaxed));
 
-		return std::async(std::launch::deferred, result_wrapper);
+		for(std::size_t j = 0; j < sleepers && woken < count; j++, woken++)
+		{
+			group.idle_cond.notify_one();
+		}
 	}
 
-private:
+	return woken;
+}
 
-	void thread_func();
-	static void s_thread_func(ThreadPool * pool);
+//
+// same thing for work only [group] can run
+//
+inline bool ThreadPool::wake_group(Group & group)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
 
-	using TaskQueue    = SyncQueue<std::future<void>>;
-	using TaskQueuePtr = std::unique_ptr<TaskQueue>;
+	if(group.sleepers.load(std::memory_order_relaxed) == 0) return false;
 
-	TaskQueuePtr            tasks_;
-	std::deque<std::thread> threads_;
+	std::lock_guard<std::mutex> lock(idle_mutex_);
 
-};
+	group.idle_cond.notify_one();
+
+	return true;
+}
 
-inline ThreadPool::ThreadPool(int num_threads) :
-	tasks_(TaskQueuePtr(new TaskQueue()))
+template <class Range, class Function>
+auto ThreadPool::async_batch(const Range & range, Function && f) -> std::vector<BatchFutureFor<Range, Function>>
 {
-	for(int i = 0; i < num_threads; i++)
+	using State =
+		detail::TaskState<
+			typename std::decay<Function>::type,
+			typename std::decay<decltype(*std::begin(range))>::type>;
+
+	std::vector<BatchFutureFor<Range, Function>> futures;
+	std::vector<TaskPtr>                         tasks;
+
+	const auto count = std::size_t(std::distance(std::begin(range), std::end(range)));
+
+	futures.reserve(count);
+	tasks.reserve(count);
+
+	for(const auto & element : range)
 	{
-		threads_.emplace_back(&s_thread_func, this);
+		const auto state = State::make(f, element);
+
+		state->set_executor(this);
+
+		futures.emplace_back(state);
+		tasks.emplace_back(state);
 	}
+
+	submit_batch(tasks);
+
+	return futures;
 }
 
-inline ThreadPool::~ThreadPool()
+template <class Range, class Function>
+Future<void> ThreadPool::async_bulk(Range & range, Function && f)
 {
-	tasks_->kill();
-	
-	join();
+	using Iterator = decltype(std::begin(range));
+	using Bulk     = BulkRun<Iterator, typename std::decay<Function>::type>;
+
+	const auto first = std::begin(range);
+	const auto count = std::size_t(std::distance(first, std::end(range)));
+
+	//
+	// a few chunks per worker, so one slow chunk doesn't leave the rest of
+	// the pool with nothing to do
+	//
+	const auto max_chunks = std::size_t(options_.max_threads) * 4;
+	const auto num_chunks = count < max_chunks ? count : max_chunks;
+
+	const auto bulk = new Bulk(std::forward<Function>(f), num_chunks);
+
+	bulk->set_executor(this);
+
+	Future<void> future(bulk);
+
+	if(num_chunks == 0)
+	{
+		bulk->fulfil_from([]() {});
+
+		return future;
+	}
+
+	auto begin = first;
+
+	for(std::size_t i = 0; i < num_chunks; i++)
+	{
+		auto end = begin;
+
+		std::advance(end, count / num_chunks + (i < count % num_chunks ? 1 : 0));
+
+		bulk->add_chunk(begin, end);
+
+		begin = end;
+	}
+
+	std::vector<TaskPtr> tasks;
+
+	tasks.reserve(num_chunks);
+
+	for(auto & chunk : bulk->chunks()) tasks.emplace_back(&chunk);
+
+	submit_batch(tasks);
+
+	return future;
 }
 
 //
-// wait for all tasks to finish
+// f_ is shared by every chunk, so it gets called from several workers at once
 //
-inline void ThreadPool::join()
+template <class Iterator, class Function>
+void ThreadPool::BulkRun<Iterator, Function>::run_chunk(Chunk & chunk)
 {
-	for(auto & t : threads_)
+	if(!failed_.load(std::memory_order_acquire))
+	{
+		try
+		{
+			for(auto it = chunk.first; it != chunk.last; ++it) f_(*it);
+		}
+		catch(...)
+		{
+			fail(std::current_exception());
+		}
+	}
+
+	if(remaining_.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+	if(failed_.load(std::memory_order_acquire))
+	{
+		fulfil_exception(error_);
+	}
+	else
 	{
-		t.join();
+		fulfil_from([]() {});
 	}
 }
 
-inline void ThreadPool::thread_func()
+template <class Iterator, class Function>
+void ThreadPool::BulkRun<Iterator, Function>::fail(std::exception_ptr error)
 {
-	for(;;)
+	if(!failed_.exchange(true, std::memory_order_acq_rel))
+	{
+		error_ = error;
+	}
+}
+
+template <class Rep, class Period, class Function>
+auto ThreadPool::async_every(const std::chrono::duration<Rep, Period> & period, Function && f) -> Timer
+{
+	using Call = PeriodicCall<typename std::decay<Function>::type>;
+
+	const auto timer =
+		new Call(this, std::chrono::duration_cast<Clock::duration>(period), std::forward<Function>(f));
+
+	Timer handle(timer);
+
+	add_timer(timer, timer->due_);
+
+	return handle;
+}
+
+inline auto ThreadPool::Timer::operator=(Timer && rhs) -> Timer &
+{
+	if(this != &rhs)
+	{
+		reset();
+
+		timer_ = rhs.timer_;
+		rhs.timer_ = nullptr;
+	}
+
+	return *this;
+}
+
+inline bool ThreadPool::Timer::cancel()
+{
+	return timer_ && timer_->pool_->cancel(timer_);
+}
+
+inline void ThreadPool::Timer::reset()
+{
+	if(timer_) timer_->release();
+
+	timer_ = nullptr;
+}
+
+inline void ThreadPool::PeriodicTimer::run()
+{
+	auto failed = false;
+
+	if(!stopped_.load(std::memory_order_acquire))
+	{
+		try
+		{
+			call();
+		}
+		catch(...)
+		{
+			failed = true;
+		}
+	}
+
+	pool_->rearm(this, failed);
+}
+
+//
+// takes over the wheel's reference to [entry]
+//
+inline void ThreadPool::add_timer(TimerEntry * const entry, const Deadline when)
+{
+	std::unique_lock<std::mutex> lock(timer_mutex_);
+
+	if(timers_dying_)
+	{
+		lock.unlock();
+
+		entry->drop();
+
+		return;
+	}
+
+	if(!timer_thread_.joinable())
+	{
+		timer_thread_ = std::thread(&ThreadPool::timer_func, this);
+	}
+
+	timers_.insert(entry, when);
+
+	num_timers_.store(timers_.size(), std::memory_order_relaxed);
+
+	if(when < timer_wake_) timer_cond_.notify_one();
+}
+
+//
+// a periodic timer's run has finished, so it goes back in the wheel for its
+// next one (unless it's been stopped)
+//
+inline void ThreadPool::rearm(PeriodicTimer * const timer, const bool stop)
+{
+	std::unique_lock<std::mutex> lock(timer_mutex_);
+
+	if(stop) timer->stopped_.store(true, std::memory_order_release);
+
+	if(timer->stopped_.load(std::memory_order_relaxed) || timers_dying_)
+	{
+		lock.unlock();
+
+		timer->release();
+
+		return;
+	}
+
+	const auto now = Clock::now();
+
+	timer->due_ += timer->period_;
+
+	if(timer->due_ <= now)
+	{
+		const auto behind = (now - timer->due_) / timer->period_ + 1;
+
+		timer->due_ += timer->period_ * behind;
+	}
+
+	timers_.insert(timer, timer->due_);
+
+	num_timers_.store(timers_.size(), std::memory_order_relaxed);
+
+	if(timer->due_ < timer_wake_) timer_cond_.notify_one();
+}
+
+inline bool ThreadPool::cancel(PeriodicTimer * const timer)
+{
+	std::unique_lock<std::mutex> lock(timer_mutex_);
+
+	if(timer->stopped_.load(std::memory_order_relaxed)) return false;
+
+	timer->stopped_.store(true, std::memory_order_release);
+
+	//
+	// if it isn't in the wheel it's queued or running, and it'll let go of
+	// its reference when it comes back to rearm
+	//
+	if(timer->linked())
+	{
+		timers_.remove(timer);
+
+		num_timers_.store(timers_.size(), std::memory_order_relaxed);
+
+		lock.unlock();
+
+		timer->release();
+	}
+
+	return true;
+}
+
+inline void ThreadPool::timer_func()
+{
+	std::unique_lock<std::mutex> lock(timer_mutex_);
+
+	while(!timers_dying_)
 	{
-		auto task = tasks_->pop();
+		auto expired = timers_.advance(Clock::now());
+
+		num_timers_.store(timers_.size(), std::memory_order_relaxed);
+
+		if(expired)
+		{
+			//
+			// nobody needs to wake us while we're busy
+			//
+			timer_wake_ = Deadline::min();
+
+			lock.unlock();
+
+			while(expired)
+			{
+				const auto next = expired->next;
+
+				static_cast<TimerEntry *>(expired)->fire(*this);
+
+				expired = next;
+			}
+
+			lock.lock();
 
-		if(!task) return;
+			continue;
+		}
 
-		task.get().get();
+		timer_wake_ = timers_.next_expiry();
+
+		if(timer_wake_ == Deadline::max())
+		{
+			timer_cond_.wait(lock);
+		}
+		else
+		{
+			timer_cond_.wait_until(lock, timer_wake_);
+		}
 	}
 }
 
-inline void ThreadPool::s_thread_func(ThreadPool * const pool)
+//
+// anything that hasn't fired by now never will
+//
+inline void ThreadPool::stop_timers()
 {
-	pool->thread_func();
+	TimerWheel::Node * pending;
+
+	{
+		std::lock_guard<std::mutex> lock(timer_mutex_);
+
+		timers_dying_ = true;
+
+		timer_cond_.notify_all();
+
+		pending = timers_.take_all();
+
+		num_timers_.store(0, std::memory_order_relaxed);
+	}
+
+	if(timer_thread_.joinable()) timer_thread_.join();
+
+	while(pending)
+	{
+		const auto next = pending->next;
+
+		static_cast<TimerEntry *>(pending)->drop();
+
+		pending = next;
+	}
 }
 
 } // namespace rtw
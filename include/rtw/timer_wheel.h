@@ -0,0 +1,367 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <rtw/meta.hpp>
+
+namespace rtw
+{
+
+namespace detail
+{
+
+//
+// a hierarchical timer wheel. LEVELS wheels of SLOTS slots each, where a slot
+// on level n covers SLOTS^n ticks. a timer goes in the lowest level whose
+// range reaches it, and gets moved down a level (cascaded) each time the level
+// below wraps around to it, until it lands in level 0 and expires
+//
+// inserting and removing a timer are O(1) (a timer is just an intrusive list
+// node). advancing costs a slot per tick, except that runs of ticks with
+// nothing in the lower levels are skipped, so a wheel with a few far off
+// timers doesn't spin through every tick on the way there
+//
+// not thread safe
+//
+class TimerWheel : private meta::NoCopy
+{
+
+public:
+
+	using Clock     = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+
+	static constexpr int           LEVEL_BITS = 6;
+	static constexpr int           LEVELS     = 6;
+	static constexpr std::uint64_t SLOTS      = std::uint64_t(1) << LEVEL_BITS;
+	static constexpr std::uint64_t SLOT_MASK  = SLOTS - 1;
+
+	//
+	// derive from this to put something in the wheel
+	//
+	struct Node
+	{
+		Node() :
+			prev(nullptr),
+			next(nullptr),
+			tick(0),
+			level(0)
+		{
+		}
+
+		bool linked() const { return prev != nullptr; }
+
+		Node *        prev;
+		Node *        next;
+		std::uint64_t tick;
+		int           level;
+	};
+
+	TimerWheel(Clock::duration resolution, TimePoint start = Clock::now());
+
+	//
+	// [node] expires on the first advance() at or after [when] (rounded up to
+	// the next tick). if [when] has already passed that's the next advance()
+	//
+	void insert(Node * node, TimePoint when);
+
+	//
+	// [node] must be linked
+	//
+	void remove(Node * node);
+
+	//
+	// unlinks everything that's due at [now] and returns it as a list strung
+	// together through next (nullptr if there's nothing)
+	//
+	Node * advance(TimePoint now);
+
+	//
+	// the next time advance() could have something to do. this might be a bit
+	// early when all that's due then is a cascade, but it's never late.
+	// TimePoint::max() if the wheel is empty
+	//
+	TimePoint next_expiry() const;
+
+	//
+	// unlinks everything, same list as advance()
+	//
+	Node * take_all();
+
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+private:
+
+	static constexpr std::uint64_t MAX_DELTA = (std::uint64_t(1) << (LEVEL_BITS * LEVELS)) - 1;
+
+	static std::uint64_t slot_of(std::uint64_t tick, int level)
+	{
+		return (tick >> (LEVEL_BITS * level)) & SLOT_MASK;
+	}
+
+	//
+	// the first multiple of SLOTS^level that's >= tick
+	//
+	static std::uint64_t round_up(std::uint64_t tick, int level)
+	{
+		const auto span = std::uint64_t(1) << (LEVEL_BITS * level);
+
+		return (tick + span - 1) & ~(span - 1);
+	}
+
+	TimePoint time_of(std::uint64_t tick) const { return start_ + resolution_ * tick; }
+
+	void link(Node * node);
+	void unlink(Node * node);
+	void cascade(int level);
+
+	//
+	// lowest level with anything in it. only call when the wheel isn't empty
+	//
+	int lowest_level() const;
+
+	//
+	// circular lists with the sentinel standing in for the slot
+	//
+	Node            slots_[LEVELS][SLOTS];
+	std::size_t     counts_[LEVELS];
+	std::size_t     size_;
+
+	//
+	// the next tick to be processed
+	//
+	std::uint64_t   current_;
+	Clock::duration resolution_;
+	TimePoint       start_;
+
+};
+
+inline TimerWheel::TimerWheel(const Clock::duration resolution, const TimePoint start) :
+	size_(0),
+	current_(0),
+	resolution_(resolution),
+	start_(start)
+{
+	for(auto & level : slots_)
+	{
+		for(auto & slot : level)
+		{
+			slot.prev = &slot;
+			slot.next = &slot;
+		}
+	}
+
+	for(auto & count : counts_) count = 0;
+}
+
+inline void TimerWheel::insert(Node * const node, const TimePoint when)
+{
+	if(when <= start_)
+	{
+		node->tick = 0;
+	}
+	else
+	{
+		const auto since_start = when - start_;
+
+		node->tick = std::uint64_t((since_start + resolution_ - Clock::duration(1)) / resolution_);
+	}
+
+	link(node);
+
+	size_++;
+}
+
+inline void TimerWheel::remove(Node * const node)
+{
+	unlink(node);
+
+	size_--;
+}
+
+inline void TimerWheel::link(Node * const node)
+{
+	//
+	// anything too far off sits in the top level as if it were due at the
+	// edge of its range, and gets put back up there each time it's cascaded
+	// until it's actually in range
+	//
+	const auto tick  = node->tick > current_ ? node->tick : current_;
+	const auto delta = tick - current_;
+	const auto place = delta > MAX_DELTA ? current_ + MAX_DELTA : tick;
+
+	auto level = 0;
+
+	while(level < LEVELS - 1 && (place - current_) >> (LEVEL_BITS * (level + 1)))
+	{
+		level++;
+	}
+
+	auto & slot = slots_[level][slot_of(place, level)];
+
+	node->level = level;
+	node->prev  = slot.prev;
+	node->next  = &slot;
+
+	slot.prev->next = node;
+	slot.prev       = node;
+
+	counts_[level]++;
+}
+
+inline void TimerWheel::unlink(Node * const node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+
+	node->prev = nullptr;
+	node->next = nullptr;
+
+	counts_[node->level]--;
+}
+
+//
+// moves everything in this level's current slot down to where it belongs now
+//
+inline void TimerWheel::cascade(const int level)
+{
+	auto & slot = slots_[level][slot_of(current_, level)];
+
+	while(slot.next != &slot)
+	{
+		const auto node = slot.next;
+
+		unlink(node);
+		link(node);
+	}
+}
+
+inline int TimerWheel::lowest_level() const
+{
+	auto level = 0;
+
+	while(level < LEVELS - 1 && counts_[level] == 0) level++;
+
+	return level;
+}
+
+inline auto TimerWheel::advance(const TimePoint now) -> Node *
+{
+	if(now < start_) return nullptr;
+
+	const auto target = std::uint64_t((now - start_) / resolution_);
+
+	Node * expired = nullptr;
+
+	while(current_ <= target)
+	{
+		if(size_ == 0)
+		{
+			current_ = target + 1;
+
+			break;
+		}
+
+		//
+		// nothing below level n means nothing can happen before level n's
+		// next cascade
+		//
+		const auto level = lowest_level();
+
+		if(level > 0)
+		{
+			const auto next = round_up(current_, level);
+
+			if(next != current_)
+			{
+				current_ = next < target + 1 ? next : target + 1;
+
+				continue;
+			}
+		}
+
+		for(auto l = 1; l < LEVELS && slot_of(current_, l - 1) == 0; l++)
+		{
+			cascade(l);
+		}
+
+		auto & slot = slots_[0][slot_of(current_, 0)];
+
+		while(slot.next != &slot)
+		{
+			const auto node = slot.next;
+
+			remove(node);
+
+			node->next = expired;
+			expired    = node;
+		}
+
+		current_++;
+	}
+
+	return expired;
+}
+
+inline auto TimerWheel::next_expiry() const -> TimePoint
+{
+	if(size_ == 0) return TimePoint::max();
+
+	const auto level = lowest_level();
+
+	if(level > 0) return time_of(round_up(current_, level));
+
+	//
+	// level 0 only holds the next SLOTS ticks, and the next cascade from
+	// higher up could bring in something sooner than what's there now
+	//
+	auto next = current_ + SLOTS;
+
+	for(auto l = 1; l < LEVELS; l++)
+	{
+		if(counts_[l] == 0) continue;
+
+		next = round_up(current_, l);
+
+		break;
+	}
+
+	for(auto tick = current_; tick < next; tick++)
+	{
+		const auto & slot = slots_[0][slot_of(tick, 0)];
+
+		if(slot.next != &slot) return time_of(tick);
+	}
+
+	return time_of(next);
+}
+
+inline auto TimerWheel::take_all() -> Node *
+{
+	Node * all = nullptr;
+
+	for(auto & level : slots_)
+	{
+		for(auto & slot : level)
+		{
+			while(slot.next != &slot)
+			{
+				const auto node = slot.next;
+
+				remove(node);
+
+				node->next = all;
+				all        = node;
+			}
+		}
+	}
+
+	return all;
+}
+
+} // namespace detail
+
+} // namespace rtw
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <rtw/error.hpp>
+
+//
+// included from rtw/event_fd.hpp. no eventfd here, so it's a pipe with a
+// byte in it while it's set
+//
+
+namespace rtw
+{
+
+inline EventFd::EventFd() :
+	read_fd_(-1),
+	write_fd_(-1)
+{
+	int fds[2];
+
+	if(pipe(fds) != 0)
+	{
+		throw std::runtime_error(error::failed_to_do_x("create a pipe", std::strerror(errno)));
+	}
+
+	for(const auto fd : fds)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	read_fd_  = fds[0];
+	write_fd_ = fds[1];
+}
+
+inline EventFd::~EventFd()
+{
+	close(read_fd_);
+	close(write_fd_);
+}
+
+//
+// if the pipe's full it's already set, so EAGAIN is fine
+//
+inline void EventFd::set()
+{
+	const char byte = 1;
+
+	while(write(write_fd_, &byte, 1) < 0 && errno == EINTR) {}
+}
+
+inline void EventFd::clear()
+{
+	char bytes[64];
+
+	for(;;)
+	{
+		const auto count = read(read_fd_, bytes, sizeof(bytes));
+
+		if(count > 0) continue;
+		if(count < 0 && errno == EINTR) continue;
+
+		break;
+	}
+}
+
+} // namespace rtw
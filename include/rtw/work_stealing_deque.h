@@ -0,0 +1,236 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <rtw/meta.hpp>
+
+namespace rtw
+{
+
+//
+// a Chase-Lev work stealing deque
+//
+// one thread (the owner) pushes and pops at the bottom, any number of other
+// threads (thieves) steal from the top. the owner's end is lock-free and
+// almost never touches a shared cache line unless the deque is nearly empty
+//
+// T has to be trivially copyable because slots are read racily by thieves. in
+// practice T is a pointer
+//
+// the buffer grows when it fills up. old buffers are kept around until the
+// deque is destroyed because a thief might still be reading from one
+//
+// see "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê, Pop,
+// Cohen, Zappa Nardelli 2013) for where the memory orderings come from
+//
+template <class T>
+class WorkStealingDeque : private meta::NoCopy
+{
+
+	static_assert(
+		std::is_trivially_copyable<T>::value,
+		"WorkStealingDeque items have to be trivially copyable");
+
+public:
+
+	WorkStealingDeque(std::size_t capacity = 256);
+
+	void push(T value);
+	bool pop(T * value);
+	bool steal(T * value);
+
+	bool empty() const;
+	std::size_t size() const;
+
+private:
+
+	class Buffer
+	{
+
+	public:
+
+		Buffer(std::size_t capacity) :
+			mask_(capacity - 1),
+			items_(new std::atomic<T>[capacity])
+		{
+		}
+
+		std::size_t capacity() const { return mask_ + 1; }
+
+		T get(std::int64_t i) const
+		{
+			return items_[std::size_t(i) & mask_].load(std::memory_order_relaxed);
+		}
+
+		void put(std::int64_t i, T value)
+		{
+			items_[std::size_t(i) & mask_].store(value, std::memory_order_relaxed);
+		}
+
+	private:
+
+		std::size_t                         mask_;
+		std::unique_ptr<std::atomic<T>[]>   items_;
+
+	};
+
+	Buffer * grow(Buffer * buffer, std::int64_t top, std::int64_t bottom);
+
+	//
+	// top_ and bottom_ live on their own cache lines. thieves hammer top_, the
+	// owner hammers bottom_
+	//
+	char                      pad0_[64];
+	std::atomic<std::int64_t> top_;
+	char                      pad1_[64 - sizeof(std::atomic<std::int64_t>)];
+	std::atomic<std::int64_t> bottom_;
+	char                      pad2_[64 - sizeof(std::atomic<std::int64_t>)];
+	std::atomic<Buffer *>     buffer_;
+
+	//
+	// owned by the owner thread. the last one is the live buffer
+	//
+	std::vector<std::unique_ptr<Buffer>> buffers_;
+
+};
+
+template <class T> WorkStealingDeque<T>::WorkStealingDeque(std::size_t capacity) :
+	top_(0),
+	bottom_(0)
+{
+	std::size_t pow2 = 1;
+
+	while(pow2 < capacity) pow2 <<= 1;
+
+	buffers_.emplace_back(new Buffer(pow2));
+
+	buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+}
+
+//
+// owner only
+//
+template <class T> void WorkStealingDeque<T>::push(T value)
+{
+	const auto bottom = bottom_.load(std::memory_order_relaxed);
+	const auto top    = top_.load(std::memory_order_acquire);
+
+	auto buffer = buffer_.load(std::memory_order_relaxed);
+
+	if(bottom - top > std::int64_t(buffer->capacity()) - 1)
+	{
+		buffer = grow(buffer, top, bottom);
+	}
+
+	buffer->put(bottom, value);
+
+	bottom_.store(bottom + 1, std::memory_order_release);
+}
+
+//
+// owner only. takes the most recently pushed item
+//
+template <class T> bool WorkStealingDeque<T>::pop(T * value)
+{
+	const auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+	const auto buffer = buffer_.load(std::memory_order_relaxed);
+
+	bottom_.store(bottom, std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	auto top = top_.load(std::memory_order_relaxed);
+
+	if(top > bottom)
+	{
+		//
+		// empty
+		//
+		bottom_.store(bottom + 1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	*value = buffer->get(bottom);
+
+	if(top < bottom) return true;
+
+	//
+	// this was the last item so we have to race the thieves for it
+	//
+	const auto won =
+		top_.compare_exchange_strong(
+			top,
+			top + 1,
+			std::memory_order_seq_cst,
+			std::memory_order_relaxed);
+
+	bottom_.store(bottom + 1, std::memory_order_relaxed);
+
+	return won;
+}
+
+//
+// any thread. takes the oldest item. can fail spuriously if another thief (or
+// the owner) got there first
+//
+template <class T> bool WorkStealingDeque<T>::steal(T * value)
+{
+	auto top = top_.load(std::memory_order_acquire);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	const auto bottom = bottom_.load(std::memory_order_acquire);
+
+	if(top >= bottom) return false;
+
+	const auto buffer = buffer_.load(std::memory_order_acquire);
+
+	*value = buffer->get(top);
+
+	return
+		top_.compare_exchange_strong(
+			top,
+			top + 1,
+			std::memory_order_seq_cst,
+			std::memory_order_relaxed);
+}
+
+template <class T> bool WorkStealingDeque<T>::empty() const
+{
+	return size() == 0;
+}
+
+//
+// only a hint when called from a thief
+//
+template <class T> std::size_t WorkStealingDeque<T>::size() const
+{
+	const auto bottom = bottom_.load(std::memory_order_relaxed);
+	const auto top    = top_.load(std::memory_order_relaxed);
+
+	return bottom > top ? std::size_t(bottom - top) : 0;
+}
+
+template <class T>
+auto WorkStealingDeque<T>::grow(Buffer * buffer, std::int64_t top, std::int64_t bottom) -> Buffer *
+{
+	std::unique_ptr<Buffer> bigger(new Buffer(buffer->capacity() * 2));
+
+	for(auto i = top; i < bottom; i++)
+	{
+		bigger->put(i, buffer->get(i));
+	}
+
+	buffers_.push_back(std::move(bigger));
+
+	buffer_.store(buffers_.back().get(), std::memory_order_release);
+
+	return buffers_.back().get();
+}
+
+} // namespace rtw